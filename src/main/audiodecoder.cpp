@@ -2,424 +2,384 @@
 #include <cstring>
 #include <thread>
 #include <cassert>
+#include <cmath>
+#include <algorithm>
 #include "audiodecoder.h"
 
 using namespace player;
 
 #define SDL_AUDIO_BUFFER_SIZE 1024
-#define MAX_AUDIO_FRAME_SIZE  192000
 #define AV_NOSYNC_THRESHOLD   1.0
 #define AUDIO_DIFF_AVG_NB     20
 #define SAMPLE_CORRECTION_PERCENT_MAX 10
 
+// seconds of pcm the decode thread keeps ahead of the audio callback
+const double AUDIO_RING_TARGET_DURATION = 0.2;
+const double AUDIO_RING_TARGET_DURATION_LOW_LATENCY = 0.04;
+const int AUDIO_RING_WAIT_MS = 10;
+const int PACKET_POP_TIMEOUT_MS = 100;
+
 void player::audioCallback(void* userdata, Uint8* stream, int len)
 {
   // retrieve the videostate
   VideoState* videoState = (VideoState *) userdata;
 
-  int len1 = -1;
-  int audioSize = -1;
+  if (videoState->isPlayerFinished())
+  {
+    auto sdlAudioDeviceID = videoState->sdlAudioDeviceID();
+    SDL_PauseAudioDevice(sdlAudioDeviceID, 1);
+    std::memset(stream, videoState->audioTgt().silence, len);
+    return;
+  }
+
+  // the device starts playing what we copy now once its current buffer is out
+  auto callbackTime = av_gettime_relative();
 
-  double pts = 0;
-  uint8_t* audioBuf = nullptr;
-  auto audioArrayBufSize = videoState->audioArrayBufSize();
-  unsigned int audioBufIndex = 0;
+  // only copy what the decode thread prepared, never decode or wait in here
+  auto serial = videoState->audioPacketSerial();
+  double endPts = 0;
+  int64_t buffered = 0;
+  int copied = videoState->audioRingBuffer().read(stream, len, serial, endPts, buffered);
 
-  while (len > 0)
+  if (copied < len)
   {
-    if (videoState->isPlayerFinished())
-    {
-      auto sdlAudioDeviceID = videoState->sdlAudioDeviceID();
-      SDL_PauseAudioDevice(sdlAudioDeviceID, 1);
-      return;
-    }
+    // underrun or seek in progress, output silence for the rest
+    std::memset(stream + copied, videoState->audioTgt().silence, len - copied);
+  }
 
-    audioBufIndex = videoState->audioBufIndex();
-    auto audioBufSize = videoState->audioBufSize();
-    if (audioBufIndex >= audioBufSize)
-    {
-      // we have already sent all avaialble data; get more
-      audioBuf = videoState->audioArrayBuf(); 
-      audioSize = player::audioDecodeFrame(videoState, audioBuf, audioArrayBufSize, pts);
+  if (copied > 0)
+  {
+    // step back from the end of the decoded samples over what is still in the
+    // ring, the samples copied into this buffer and the device buffer being
+    // played, in stream time. the silence padding an underrun carries no samples
+    auto bytesPerSec = videoState->audioBytesPerSec();
+    auto pending = buffered + copied + videoState->audioHwBufSize();
+    auto pts = endPts - (double)pending / bytesPerSec * videoState->playbackSpeed();
+    videoState->setAudioPlayClock(pts, serial, callbackTime);
+  }
+}
 
-      if (audioSize < 0)
-      {
-        // output silence
-        audioBufSize = 1024;
-        videoState->setAudioBufSize(audioBufSize);
+AudioDecoder::~AudioDecoder()
+{
+  this->stop();
 
-        // clear memory
-        std::memset(audioBuf, 0, audioBufSize);
-      }
-      else
-      {
-        audioSize = player::syncAudio(videoState, (int16_t *)audioBuf, audioSize);
-        audioBufSize = audioSize;
-        videoState->setAudioBufSize(audioBufSize);
-      }
-      audioBufIndex = 0;
-      videoState->setAudioBufIndex(audioBufIndex);
-    }
+  if (m_frame)
+  {
+    av_frame_free(&m_frame);
+  }
+  if (m_packet)
+  {
+    av_packet_free(&m_packet);
+  }
+}
 
-    len1 = audioBufSize - audioBufIndex;
+int AudioDecoder::start(std::shared_ptr<VideoState> vs)
+{
+  m_vs = vs;
+  if (!m_vs)
+  {
+    return -1;
+  }
 
-    if (len1 > len)
-    {
-      len1 = len;
-    }
+  m_packet = av_packet_alloc();
+  m_frame = av_frame_alloc();
+  if (!m_packet || !m_frame)
+  {
+    std::cerr << "Could not allocate audio packet or frame" << std::endl;
+    return -1;
+  }
 
-    // copy data from audio buffer to the SDL stream
-    std::memcpy(stream, (uint8_t *)audioBuf + audioBufIndex, len1);
+  // the running average of the a/v difference forgets a measure after AUDIO_DIFF_AVG_NB frames
+  m_vs->setAudioDiffAvgCoef(exp(log(0.01) / AUDIO_DIFF_AVG_NB));
+  m_vs->setAudioDiffAvgCount(0);
+  m_vs->setAudioDiffCum(0);
 
-    len -= len1;
-    stream += len1;
-    videoState->setAudioBufIndex(audioBufIndex + len1);
-  }
+  m_thread = std::thread([&](AudioDecoder *decoder)
+  {
+    decoder->decodeThread(m_vs);
+  }, this);
+  return 0;
 }
 
-int player::audioDecodeFrame(VideoState* vs, uint8_t* audio_buf, int bufSize, double& pts_ptr)
+void AudioDecoder::stop()
 {
-  AVPacket* avPacket = av_packet_alloc();
-  static uint8_t* audioPktData = nullptr;
-  static int audioPktSize = 0;
-
-  int n = 0;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finishedDecoder = true;
+  }
 
-  // allocate a new frame, used to decode audio packets
-  AVFrame* avFrame = av_frame_alloc();
-  if (!avFrame)
+  // the thread uses the packet and frame we own, wait for it before they go away
+  if (m_thread.joinable())
   {
-    return -1;
+    m_thread.join();
   }
+}
 
-  int len1 = 0;
-  int dataSize = 0;
+bool AudioDecoder::isFinished()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_finishedDecoder;
+}
 
-  auto& audioCodecCtx = vs->audioCodecCtx();
+int AudioDecoder::decodeThread(std::shared_ptr<VideoState> vs)
+{
+  auto& ringBuffer = vs->audioRingBuffer();
 
-  for (;;)
+  while (!this->isFinished() && !vs->isPlayerFinished())
   {
-    while (audioPktSize > 0)
+    // keep a bounded amount of audio decoded ahead of the callback
+    auto targetDuration = vs->isLowLatency() ? AUDIO_RING_TARGET_DURATION_LOW_LATENCY : AUDIO_RING_TARGET_DURATION;
+    auto target = (int64_t)(vs->audioBytesPerSec() * targetDuration);
+    if (ringBuffer.fill() >= target)
     {
-      int got_frame = 0;
+      ringBuffer.waitBelow(target, AUDIO_RING_WAIT_MS);
+      continue;
+    }
 
-      int ret = avcodec_receive_frame(audioCodecCtx, avFrame);
-      if (ret == 0)
-      {
-        got_frame = 1;
-      }
+    int audioSize = this->decodeFrame(vs.get(), m_audioBuf, AUDIO_BUF_SIZE);
+    if (audioSize <= 0)
+    {
+      // no packet arrived in time
+      continue;
+    }
 
-      if (ret == AVERROR(EAGAIN))
+    // audioClock now points right after the decoded samples
+    auto endPts = vs->audioClock();
+    auto serial = vs->audioBufSerial();
+    while (ringBuffer.write(m_audioBuf, audioSize, endPts, serial) < 0)
+    {
+      // a seek makes these samples useless, the player may be stopping
+      if (this->isFinished() || vs->isPlayerFinished() || serial != vs->audioPacketSerial())
       {
-        ret = 0;
+        break;
       }
+      ringBuffer.waitBelow(ringBuffer.capacity() - audioSize + 1, AUDIO_RING_WAIT_MS);
+    }
+  }
+
+  if (m_packetPending)
+  {
+    av_packet_unref(m_packet);
+    m_packetPending = false;
+  }
+  return 0;
+}
 
+int AudioDecoder::decodeFrame(VideoState* vs, uint8_t* audioBuf, int bufSize)
+{
+  auto& audioCodecCtx = vs->audioCodecCtx();
+
+  for (;;)
+  {
+    // everything the codec holds predates the latest seek, go straight to the next packet
+    if (m_pktSerial == vs->audioPacketSerial())
+    {
+      // drain the frames of the packets already sent, through the tempo filter
+      int ret = this->receiveFrame(vs);
       if (ret == 0)
       {
-        ret = avcodec_send_packet(audioCodecCtx, avPacket);
-      }
+        // exact seek : drop the samples before the target, audio_clock is right
+        // after this frame and the frame covers speed times its length of stream
+        double trimSeconds = 0.0;
+        double seekTarget = (m_seekDoneSerial != m_pktSerial) ? vs->audioSeekTarget(m_pktSerial) : NAN;
+        if (!std::isnan(seekTarget))
+        {
+          auto speed = vs->playbackSpeed();
+          auto frameEnd = vs->audioClock();
+          auto frameStart = frameEnd - (double)m_frame->nb_samples / m_frame->sample_rate * speed;
+          if (frameEnd <= seekTarget)
+          {
+            av_frame_unref(m_frame);
+            continue;
+          }
 
-      if (ret == AVERROR(EAGAIN))
-      {
-        ret = 0;
-      }
-      else if (ret < 0)
-      {
-        return -1;
-      }
-      else
-      {
-        len1 = avPacket->size;
-      }
+          m_seekDoneSerial = m_pktSerial;
+          trimSeconds = std::max(seekTarget - frameStart, 0.0) / speed;
+        }
 
-      if (len1 < 0)
-      {
-        // if error, skip frame
-        audioPktSize = 0;
-        break;
-      }
+        // how many samples this frame should last to drift back toward the master clock
+        int wantedNbSamples = this->syncAudio(vs, m_frame);
 
-      audioPktData += len1;
-      audioPktSize -= len1;
-      dataSize = 0;
+        // audio resampling, straight to the device format
+        int dataSize = this->resampling(vs, m_frame, wantedNbSamples, audioBuf, bufSize);
+        av_frame_unref(m_frame);
 
-      if (got_frame)
-      {
-        // audio resampling
-        dataSize = player::audioResampling(
-          vs
-          , avFrame
-          , AVSampleFormat::AV_SAMPLE_FMT_S16
-          , audio_buf);
+        if (dataSize > 0 && trimSeconds > 0.0)
+        {
+          // cut the head in whole sample frames of the device format
+          auto& audioTgt = vs->audioTgt();
+          int trimSize = (int)(trimSeconds * audioTgt.freq) * audioTgt.frameSize;
+          trimSize = std::min(trimSize, dataSize);
+          memmove(audioBuf, audioBuf + trimSize, dataSize - trimSize);
+          dataSize -= trimSize;
+        }
 
+        if (dataSize <= 0)
+        {
+          // nothing usable in this frame, get the next one
+          continue;
+        }
         assert(dataSize <= bufSize);
-      }
 
-      if (dataSize <= 0)
+        vs->setAudioBufSerial(m_pktSerial);
+
+        // we have the data, return it and come back for more later
+        return dataSize;
+      }
+      else if (ret != AVERROR(EAGAIN))
       {
-        // no data yet, get more frames
-        continue;
+        std::cerr << "Error while decoding audio" << std::endl;
+        avcodec_flush_buffers(audioCodecCtx);
       }
 
-      // keep audio_clock up to date
-      auto audioClock = vs->audioClock();
-      pts_ptr = audioClock;
-      n = 2 * audioCodecCtx->ch_layout.nb_channels;
-      audioClock += (double)dataSize / (double)(n * audioCodecCtx->sample_rate);
-      vs->setAudioClock(audioClock);
-
-      if (avPacket->data)
+      // the codec needs input, retry the packet it refused earlier
+      if (m_packetPending)
       {
-        // wipe the packet
-        av_packet_unref(avPacket);
+        ret = avcodec_send_packet(audioCodecCtx, m_packet);
+        if (ret != AVERROR(EAGAIN))
+        {
+          av_packet_unref(m_packet);
+          m_packetPending = false;
+        }
+        continue;
       }
-      av_frame_free(&avFrame);
-
-      // we have the data, return it and come back for more later
-      return dataSize;
     }
-
-    if (avPacket->data)
+    else if (m_packetPending)
     {
-      av_packet_unref(avPacket);
+      av_packet_unref(m_packet);
+      m_packetPending = false;
     }
 
-    // get more audio AVPacket
-    int ret = vs->popAudioPacketRead(avPacket);
+    // get more audio AVPacket, the decode thread may wait for the reader
+    int serial = -1;
+    int ret = vs->popAudioPacketRead(m_packet, PACKET_POP_TIMEOUT_MS, &serial);
 
-    // if packet_queue_get returns < 0, the global quit flag was set
+    // the queue was aborted or stayed empty
     if (ret < 0)
     {
       return -1;
     }
 
-    auto& flushPacket = vs->flushPacket();
-    if (flushPacket)
+    // the packet was queued before the latest seek
+    if (serial != vs->audioPacketSerial())
     {
-      if (avPacket->data == flushPacket->data)
-      {
-        avcodec_flush_buffers(audioCodecCtx);
-        continue;
-      }
+      av_packet_unref(m_packet);
+      continue;
     }
 
-    audioPktData = avPacket->data;
-    audioPktSize = avPacket->size;
+    // first packet after a seek, drop the samples buffered in the codec and the filter
+    if (serial != m_pktSerial)
+    {
+      avcodec_flush_buffers(audioCodecCtx);
+      m_tempoFilter.release();
+      m_pktSerial = serial;
+    }
 
     // keep audio_clock up to date
-    if (avPacket->pts != AV_NOPTS_VALUE)
+    if (m_packet->pts != AV_NOPTS_VALUE)
     {
       auto& audioStream = vs->audioStream();
-      auto audioClock = av_q2d(audioStream->time_base) * avPacket->pts;
+      auto audioClock = av_q2d(audioStream->time_base) * m_packet->pts;
       vs->setAudioClock(audioClock);
     }
-  }
 
-  av_frame_unref(avFrame);
-  avFrame = nullptr;
-  return 0;
+    ret = avcodec_send_packet(audioCodecCtx, m_packet);
+    if (ret == AVERROR(EAGAIN))
+    {
+      m_packetPending = true;
+      continue;
+    }
+    else if (ret < 0)
+    {
+      std::cerr << "Error sending audio packet for decoding" << std::endl;
+    }
+    av_packet_unref(m_packet);
+  }
 }
 
-int player::audioResampling(
-  VideoState* vs
-  , AVFrame* decoded_audio_frame
-  , AVSampleFormat out_sample_fmt
-  , uint8_t* out_buf)
+int AudioDecoder::receiveFrame(VideoState* vs)
 {
-  // get an instance of the audioresamplingstate struct
-  AudioReSamplingState arState;
   auto& audioCodecCtx = vs->audioCodecCtx();
-  arState.init(audioCodecCtx->ch_layout.nb_channels);
-  if (!arState.swr_ctx)
-  {
-    printf("swr_alloc error.\n");
-    return -1;
-  }
-
-  // get input audio channels
-  arState.in_channel_layout = audioCodecCtx->ch_layout.nb_channels;
-
-  // check input audio channels correctly retrieved
-  if (arState.in_channel_layout <= 0)
-  {
-    player::audioReleasePointer(arState);
-    return -1;
-  }
-
-  // set output audio channels based on the input audio channels
-  if (audioCodecCtx->ch_layout.nb_channels == 1)
-  {
-    arState.out_channel_layout = AV_CH_LAYOUT_MONO;
-  }
-  else if (audioCodecCtx->ch_layout.nb_channels == 2)
-  {
-    arState.out_channel_layout = AV_CH_LAYOUT_STEREO;
-  }
-  else
-  {
-    arState.out_channel_layout = AV_CH_LAYOUT_SURROUND;
-  }
-
-  // retrieve number of audio samples (per channel)
-  arState.in_nb_samples = decoded_audio_frame->nb_samples;
-  if (arState.in_nb_samples <= 0)
-  {
-    printf("in_nb_samples error.\n");
-    player::audioReleasePointer(arState);
-    return -1;
-  }
-
-  // Set SwrContext parameters for resampling
-  av_opt_set_int(arState.swr_ctx, "in_channel_layout", arState.in_channel_layout, 0);
-  av_opt_set_int(arState.swr_ctx, "in_sample_rate", audioCodecCtx->sample_rate, 0);
-  av_opt_set_sample_fmt(arState.swr_ctx, "in_sample_fmt", audioCodecCtx->sample_fmt, 0);
-  av_opt_set_int(arState.swr_ctx, "out_channel_layout", arState.out_channel_layout, 0);
-  av_opt_set_int(arState.swr_ctx, "out_sample_rate", audioCodecCtx->sample_rate, 0);
-  av_opt_set_sample_fmt(arState.swr_ctx, "out_sample_fmt", out_sample_fmt, 0);
-
-  // Once all values have been set for the SwrContext, it must be initialized
-  // with swr_init().
-  int ret = swr_init(arState.swr_ctx);
-  if (ret < 0)
-  {
-    printf("Failed to initialize the resampling context.\n");
-    player::audioReleasePointer(arState);
-    return -1;
-  }
-
-  arState.max_out_nb_samples = arState.out_nb_samples = av_rescale_rnd(
-    arState.in_nb_samples,
-    audioCodecCtx->sample_rate,
-    audioCodecCtx->sample_rate,
-    AV_ROUND_UP
-    );
-
-  // check rescaling was successful
-  if (arState.max_out_nb_samples <= 0)
-  {
-    printf("av_rescale_rnd error.\n");
-    player::audioReleasePointer(arState);
-    return -1;
-  }
-
-  // get number of output audio channels
-  arState.out_nb_channels = audioCodecCtx->ch_layout.nb_channels;
-
-  ret = av_samples_alloc_array_and_samples(
-    &arState.resampled_data,
-    &arState.out_linesize,
-    arState.out_nb_channels,
-    arState.out_nb_samples,
-    out_sample_fmt,
-    0
-    );
+  auto speed = vs->playbackSpeed();
 
-  if (ret < 0)
-  {
-    printf("av_samples_alloc_array_and_samples() error: Could not allocate destination samples.\n");
-    player::audioReleasePointer(arState);
-    return -1;
-  }
-
-  // retrieve output samples number taking into account the progressive delay
-  auto swrDelay = swr_get_delay(arState.swr_ctx, audioCodecCtx->sample_rate);
-  arState.out_nb_samples = av_rescale_rnd(
-    swrDelay + arState.in_nb_samples
-    , audioCodecCtx->sample_rate
-    , audioCodecCtx->sample_rate
-    , AV_ROUND_UP
-    );
-
-  // check output samples number was correctly retrieved
-  if (arState.out_nb_samples <= 0)
+  // a new rate needs a new graph, 1x bypasses the filter altogether
+  if (m_tempoFilter.isConfigured() && m_tempoFilter.tempo() != speed)
   {
-    player::audioReleasePointer(arState);
-    return -1;
+    m_tempoFilter.release();
   }
 
-  if (arState.out_nb_samples > arState.max_out_nb_samples)
+  for (;;)
   {
-    // free memory block and set pointer to NULL
-    av_free(arState.resampled_data[0]);
-
-    // Allocate a samples buffer for out_nb_samples samples
-    ret = av_samples_alloc(
-      arState.resampled_data
-      , &arState.out_linesize
-      , arState.out_nb_channels
-      , arState.out_nb_samples
-      , out_sample_fmt
-      , 1
-      );
-
-    // check samples buffer correctly allocated
-    if (ret < 0)
+    if (m_tempoFilter.isConfigured())
     {
-      printf("av_samples_alloc failed.\n");
-      player::audioReleasePointer(arState);
-      return -1;
+      int ret = m_tempoFilter.pull(m_frame);
+      if (ret != AVERROR(EAGAIN))
+      {
+        return ret;
+      }
     }
-    arState.max_out_nb_samples = arState.out_nb_samples;
-  }
 
-  if (arState.swr_ctx)
-  {
-    // do the actual audio data resampling
-    ret = swr_convert(
-      arState.swr_ctx
-      , arState.resampled_data
-      , arState.out_nb_samples
-      , (const uint8_t **) decoded_audio_frame->data
-      , decoded_audio_frame->nb_samples);
-
-    // check audio conversion was successful
+    int ret = avcodec_receive_frame(audioCodecCtx, m_frame);
     if (ret < 0)
     {
-      printf("swr_convert_error.\n");
-      player::audioReleasePointer(arState);
-      return -1;
+      return ret;
     }
 
-    // Get the required buffer size for the given audio parameters
-    arState.resampled_data_size = av_samples_get_buffer_size(
-      &arState.out_linesize
-      , arState.out_nb_channels
-      , ret
-      , out_sample_fmt
-      , 1);
+    // keep audio_clock up to date, in stream time whatever the filter and compensation do
+    auto audioClock = vs->audioClock();
+    audioClock += (double)m_frame->nb_samples / m_frame->sample_rate;
+    vs->setAudioClock(audioClock);
 
-    // check audio buffer size
-    if (arState.resampled_data_size < 0)
+    if (speed == 1.0)
     {
-      printf("av_samples_get_buffer_size error.\n");
-      player::audioReleasePointer(arState);
-      return -1;
+      return 0;
+    }
+
+    if (m_tempoFilter.configure(m_frame, speed) < 0 || m_tempoFilter.push(m_frame) < 0)
+    {
+      // play the frame at its own rate rather than losing it
+      m_tempoFilter.release();
+      return 0;
     }
   }
-  else
+}
+
+int AudioDecoder::resampling(
+  VideoState* vs
+  , AVFrame* decoded_audio_frame
+  , const int& wantedNbSamples
+  , uint8_t* out_buf
+  , const int& out_buf_size)
+{
+  auto& arState = m_audioReSamplingState;
+  auto& audioTgt = vs->audioTgt();
+
+  // check input audio samples correctly retrieved
+  if (decoded_audio_frame->nb_samples <= 0 || decoded_audio_frame->ch_layout.nb_channels <= 0)
   {
-    printf("swr_ctx null error.\n");
-    player::audioReleasePointer(arState);
+    std::cerr << "in_nb_samples error." << std::endl;
     return -1;
   }
 
-  // copy the resampled data to the output buffer
-  std::memcpy(out_buf, arState.resampled_data[0], arState.resampled_data_size);
+  // output the format, channel count and rate the audio device was opened with
+  AVChannelLayout outChLayout{};
+  av_channel_layout_default(&outChLayout, audioTgt.channels);
 
-  /*
-   * Memory Cleanup.
-   */
-  player::audioReleasePointer(arState);
+  int ret = arState.configure(decoded_audio_frame, audioTgt.fmt, audioTgt.freq, outChLayout);
+  av_channel_layout_uninit(&outChLayout);
+  if (ret < 0)
+  {
+    return -1;
+  }
 
-  return arState.resampled_data_size;
+  return arState.convert(decoded_audio_frame, wantedNbSamples, out_buf, out_buf_size);
 }
 
-int player::syncAudio(VideoState* vs, short* samples, int& samplesSize)
+int AudioDecoder::syncAudio(VideoState* vs, const AVFrame* frame)
 {
-  auto& audioCodecCtx = vs->audioCodecCtx();
-  int n = 2 * audioCodecCtx->ch_layout.nb_channels;
+  int wantedNbSamples = frame->nb_samples;
 
-  // check
+  // audio is only stretched when it has to follow another clock
   auto avSyncType = vs->syncType();
   if (avSyncType != SYNC_TYPE::AV_SYNC_AUDIO_MASTER)
   {
@@ -427,64 +387,28 @@ int player::syncAudio(VideoState* vs, short* samples, int& samplesSize)
     auto audioClock = vs->calcAudioClock();
     auto diff = audioClock - refClock;
 
-    if (diff < AV_NOSYNC_THRESHOLD)
+    if (!std::isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD)
     {
       // accumulate the diffs
       auto audioDiffAvgCoef = vs->audioDiffAvgCoef();
-      auto audioDiffCum = vs->audioDiffCum();
-      vs->setAudioDiffCum(diff + audioDiffAvgCoef * audioDiffCum);
+      auto audioDiffCum = diff + audioDiffAvgCoef * vs->audioDiffCum();
+      vs->setAudioDiffCum(audioDiffCum);
       auto audioDiffAvgCount = vs->audioDiffAvgCount();
       if (audioDiffAvgCount < AUDIO_DIFF_AVG_NB)
       {
-        audioDiffAvgCount++;
-        vs->setAudioDiffAvgCount(audioDiffAvgCount);
+        // not enough measures to have a correct estimate
+        vs->setAudioDiffAvgCount(audioDiffAvgCount + 1);
       }
       else
       {
-        auto audioDiffCum = vs->audioDiffCum();
-        auto audioDiffAvgCoef = vs->audioDiffAvgCoef();
         auto avgDiff = audioDiffCum * (1.0 - audioDiffAvgCoef);
-        auto audioDiffThreshold = vs->audioDiffThreshold();
-        if (fabs(avgDiff) >= audioDiffThreshold)
+        if (fabs(avgDiff) >= vs->audioDiffThreshold())
         {
-          auto sampleRate = audioCodecCtx->sample_rate;
-          auto wantedSize = samplesSize + ((int)(diff * sampleRate) * n);
-          auto minSize = samplesSize * ((100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100);
-          auto maxSize = samplesSize * ((100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100);
-
-          if (wantedSize < minSize)
-          {
-            wantedSize = minSize;
-          }
-          else if (wantedSize > maxSize)
-          {
-            wantedSize = maxSize;
-          }
-
-          if (wantedSize < samplesSize)
-          {
-            // remove samples
-            samplesSize = wantedSize;
-          }
-          else if (wantedSize > samplesSize)
-          {
-            uint8_t* samplesEnd = nullptr;
-            uint8_t* dst = nullptr;
-
-            // add samples by copying final sample
-            auto nb = (samplesSize - wantedSize);
-            samplesEnd = (uint8_t *)samples + samplesSize - n;
-            dst = samplesEnd + n;
-
-            while (nb > 0)
-            {
-              std::memcpy(dst, samplesEnd, n);
-              dst += n;
-              nb -= n;
-            }
-
-            samplesSize = wantedSize;
-          }
+          // at most SAMPLE_CORRECTION_PERCENT_MAX percent shorter or longer
+          wantedNbSamples = frame->nb_samples + (int)(diff * frame->sample_rate);
+          int minNbSamples = frame->nb_samples * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+          int maxNbSamples = frame->nb_samples * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+          wantedNbSamples = std::clamp(wantedNbSamples, minNbSamples, maxNbSamples);
         }
       }
     }
@@ -496,26 +420,5 @@ int player::syncAudio(VideoState* vs, short* samples, int& samplesSize)
     }
   }
 
-  return samplesSize;
-}
-
-void player::audioReleasePointer(AudioReSamplingState& arState)
-{
-  /*
-   * Memory Cleanup.
-   */
-  if (arState.resampled_data)
-  {
-    // free memory block and set pointer to NULL
-    av_freep(&arState.resampled_data[0]);
-  }
-
-  av_freep(&arState.resampled_data);
-
-  arState.resampled_data = NULL;
-  if (arState.swr_ctx)
-  {
-    // Free the given SwrContext and set the pointer to NULL
-    swr_free(&arState.swr_ctx);
-  }
+  return wantedNbSamples;
 }
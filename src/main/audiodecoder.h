@@ -1,12 +1,14 @@
-
 #ifndef AUDIO_DECODER_H_
 #define AUDIO_DECODER_H_
 
 #include <iostream>
 #include <string>
+#include <mutex>
+#include <thread>
 #include "packetqueue.h"
 #include "videostate.h"
 #include "audioresamplingstate.h"
+#include "audiotempofilter.h"
 
 extern "C"
 {
@@ -20,12 +22,55 @@ extern "C"
 
 namespace player
 {
+
+#define MAX_AUDIO_FRAME_SIZE 192000
+// resampler output, room for the largest frame stretched by the sync correction
+#define AUDIO_BUF_SIZE ((MAX_AUDIO_FRAME_SIZE * 3) / 2)
+
+  // sdl audio callback, only drains the pcm ring filled by the AudioDecoder
   void audioCallback(void* userdata, Uint8* stream, int len);
-  int audioDecodeFrame(VideoState* vs, uint8_t* audio_buf, int buf_size, double& ptsPtr);
-  int audioResampling(VideoState* vs, AVFrame* decodedAudioFrame, AVSampleFormat outSampleFmt, uint8_t* outBuf);
-  int syncAudio(VideoState* vs, short* samples, int& samplesSize);
-  void audioReleasePointer(AudioReSamplingState& arState);
 
-}
+class AudioDecoder
+{
+public:
+  explicit AudioDecoder() = default;
+  ~AudioDecoder();
+
+  int start(std::shared_ptr<VideoState> vs);
+  void stop();
+
+private:
+  std::shared_ptr<VideoState> m_vs = nullptr;
+  std::thread m_thread;
+  std::mutex m_mutex;
+  bool m_finishedDecoder = false;
+
+  // reused for every packet and frame of the stream
+  AVPacket* m_packet = nullptr;
+  AVFrame* m_frame = nullptr;
+  // the codec refused m_packet, send it again once its frames are drained
+  bool m_packetPending = false;
+  // serial of the last packet fed to the codec
+  int m_pktSerial = -1;
+  // converts the decoded frames to the format the device was opened with,
+  // only rebuilt on a format change
+  AudioReSamplingState m_audioReSamplingState;
+  // output of the resampler, copied into the pcm ring
+  uint8_t m_audioBuf[AUDIO_BUF_SIZE];
+  // time stretching when the playback speed is not 1x
+  AudioTempoFilter m_tempoFilter;
+  // serial whose exact seek target was reached
+  int m_seekDoneSerial = -1;
+
+  bool isFinished();
+  int decodeThread(std::shared_ptr<VideoState> vs);
+  int decodeFrame(VideoState* vs, uint8_t* audioBuf, int bufSize);
+  int receiveFrame(VideoState* vs);
+  int resampling(VideoState* vs, AVFrame* decodedAudioFrame, const int& wantedNbSamples, uint8_t* outBuf, const int& outBufSize);
+  // number of output samples, in input rate, the frame should last to follow the master clock
+  int syncAudio(VideoState* vs, const AVFrame* frame);
+};
+
+} // player
 
 #endif // AUDIO_DECODER_H_
@@ -0,0 +1,30 @@
+
+#ifndef AUDIO_PARAMS_H_
+#define AUDIO_PARAMS_H_
+
+extern "C"
+{
+#include <libavutil/samplefmt.h>
+#include <libavutil/channel_layout.h>
+}
+
+#include <cstdint>
+
+namespace player
+{
+
+// format of the samples handed to the audio device, as negotiated with SDL
+struct AudioParams
+{
+  int freq = 0;
+  int channels = 0;
+  AVSampleFormat fmt = AV_SAMPLE_FMT_NONE;
+  // bytes of one sample for every channel
+  int frameSize = 0;
+  int bytesPerSec = 0;
+  uint8_t silence = 0;
+};
+
+} // player
+
+#endif // AUDIO_PARAMS_H_
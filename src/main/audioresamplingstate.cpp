@@ -1,14 +1,18 @@
 
+#include <cstring>
+#include <algorithm>
+#include <iostream>
 #include "audioresamplingstate.h"
 
 AudioReSamplingState::AudioReSamplingState()
   : swr_ctx(nullptr)
-  , in_channel_layout(0)
-  , out_channel_layout(0)
-  , out_nb_channels(0)
+  , in_sample_fmt(AV_SAMPLE_FMT_NONE)
+  , in_sample_rate(0)
+  , in_ch_layout{}
+  , out_sample_fmt(AV_SAMPLE_FMT_NONE)
+  , out_sample_rate(0)
+  , out_ch_layout{}
   , out_linesize(0)
-  , in_nb_samples(0)
-  , out_nb_samples(0)
   , max_out_nb_samples(0)
   , resampled_data(nullptr)
   , resampled_data_size(0)
@@ -17,18 +21,201 @@ AudioReSamplingState::AudioReSamplingState()
 
 AudioReSamplingState::~AudioReSamplingState()
 {
+  this->release();
 }
 
-void AudioReSamplingState::init(uint64_t channel_layout)
+int AudioReSamplingState::configure(
+  const AVFrame* frame
+  , const AVSampleFormat& outSampleFmt
+  , const int& outSampleRate
+  , const AVChannelLayout& outChLayout)
 {
-  swr_ctx = swr_alloc();
-  in_channel_layout = channel_layout;
-  out_channel_layout = AV_CH_LAYOUT_STEREO;
-  out_nb_channels = 0;
-  out_linesize = 0;
-  in_nb_samples = 0;
-  out_nb_samples = 0;
+  auto inSampleFmt = (AVSampleFormat)frame->format;
+
+  // nothing changed, keep the context and its filter state
+  if (swr_ctx
+      && in_sample_fmt == inSampleFmt
+      && in_sample_rate == frame->sample_rate
+      && av_channel_layout_compare(&in_ch_layout, &frame->ch_layout) == 0
+      && out_sample_fmt == outSampleFmt
+      && out_sample_rate == outSampleRate
+      && av_channel_layout_compare(&out_ch_layout, &outChLayout) == 0)
+  {
+    return 0;
+  }
+
+  if (swr_ctx)
+  {
+    // Free the given SwrContext and set the pointer to NULL
+    swr_free(&swr_ctx);
+  }
+
+  // Set SwrContext parameters for resampling
+  int ret = swr_alloc_set_opts2(
+    &swr_ctx
+    , &outChLayout
+    , outSampleFmt
+    , outSampleRate
+    , &frame->ch_layout
+    , inSampleFmt
+    , frame->sample_rate
+    , 0
+    , nullptr);
+  if (ret < 0 || !swr_ctx)
+  {
+    std::cerr << "swr_alloc_set_opts2 error." << std::endl;
+    return -1;
+  }
+
+  // Once all values have been set for the SwrContext, it must be initialized
+  // with swr_init().
+  ret = swr_init(swr_ctx);
+  if (ret < 0)
+  {
+    std::cerr << "Failed to initialize the resampling context." << std::endl;
+    swr_free(&swr_ctx);
+    return -1;
+  }
+
+  // the output buffer is sized for the old format, let convert() grow a new one
+  if (out_sample_fmt != outSampleFmt || av_channel_layout_compare(&out_ch_layout, &outChLayout) != 0)
+  {
+    if (resampled_data)
+    {
+      av_freep(&resampled_data[0]);
+    }
+    av_freep(&resampled_data);
+    max_out_nb_samples = 0;
+  }
+
+  in_sample_fmt = inSampleFmt;
+  in_sample_rate = frame->sample_rate;
+  av_channel_layout_uninit(&in_ch_layout);
+  av_channel_layout_copy(&in_ch_layout, &frame->ch_layout);
+  out_sample_fmt = outSampleFmt;
+  out_sample_rate = outSampleRate;
+  av_channel_layout_uninit(&out_ch_layout);
+  av_channel_layout_copy(&out_ch_layout, &outChLayout);
+
+  return 0;
+}
+
+int AudioReSamplingState::convert(const AVFrame* frame, const int& wantedNbSamples, uint8_t* outBuf, const int& outBufSize)
+{
+  if (!swr_ctx)
+  {
+    std::cerr << "swr_ctx null error." << std::endl;
+    return -1;
+  }
+
+  if (wantedNbSamples != frame->nb_samples)
+  {
+    // drift correction, spread over this frame in output samples
+    int ret = swr_set_compensation(
+      swr_ctx
+      , (wantedNbSamples - frame->nb_samples) * out_sample_rate / frame->sample_rate
+      , wantedNbSamples * out_sample_rate / frame->sample_rate);
+    if (ret < 0)
+    {
+      std::cerr << "swr_set_compensation error." << std::endl;
+      return -1;
+    }
+  }
+
+  // retrieve output samples number taking into account the progressive delay
+  auto outNbSamples = av_rescale_rnd(
+    swr_get_delay(swr_ctx, in_sample_rate) + std::max(wantedNbSamples, frame->nb_samples)
+    , out_sample_rate
+    , in_sample_rate
+    , AV_ROUND_UP
+    );
+  if (outNbSamples <= 0)
+  {
+    std::cerr << "av_rescale_rnd error." << std::endl;
+    return -1;
+  }
+
+  // the buffer only grows, steady state playback does not allocate
+  if (outNbSamples > max_out_nb_samples)
+  {
+    if (resampled_data)
+    {
+      av_freep(&resampled_data[0]);
+    }
+    av_freep(&resampled_data);
+
+    int ret = av_samples_alloc_array_and_samples(
+      &resampled_data
+      , &out_linesize
+      , out_ch_layout.nb_channels
+      , (int)outNbSamples
+      , out_sample_fmt
+      , 0
+      );
+    if (ret < 0)
+    {
+      std::cerr << "av_samples_alloc_array_and_samples() error: Could not allocate destination samples." << std::endl;
+      max_out_nb_samples = 0;
+      return -1;
+    }
+    max_out_nb_samples = outNbSamples;
+  }
+
+  // do the actual audio data resampling
+  int nbSamples = swr_convert(
+    swr_ctx
+    , resampled_data
+    , (int)outNbSamples
+    , (const uint8_t **)frame->extended_data
+    , frame->nb_samples);
+
+  // check audio conversion was successful
+  if (nbSamples < 0)
+  {
+    std::cerr << "swr_convert error." << std::endl;
+    return -1;
+  }
+
+  // Get the required buffer size for the given audio parameters
+  resampled_data_size = av_samples_get_buffer_size(
+    nullptr
+    , out_ch_layout.nb_channels
+    , nbSamples
+    , out_sample_fmt
+    , 1);
+
+  // check audio buffer size
+  if (resampled_data_size < 0 || resampled_data_size > outBufSize)
+  {
+    std::cerr << "av_samples_get_buffer_size error." << std::endl;
+    return -1;
+  }
+
+  // copy the resampled data to the output buffer
+  std::memcpy(outBuf, resampled_data[0], resampled_data_size);
+
+  return resampled_data_size;
+}
+
+void AudioReSamplingState::release()
+{
+  /*
+   * Memory Cleanup.
+   */
+  if (resampled_data)
+  {
+    // free memory block and set pointer to NULL
+    av_freep(&resampled_data[0]);
+  }
+  av_freep(&resampled_data);
   max_out_nb_samples = 0;
-  resampled_data = nullptr;
-  resampled_data_size = 0;
+
+  if (swr_ctx)
+  {
+    // Free the given SwrContext and set the pointer to NULL
+    swr_free(&swr_ctx);
+  }
+
+  av_channel_layout_uninit(&in_ch_layout);
+  av_channel_layout_uninit(&out_ch_layout);
 }
@@ -4,24 +4,41 @@
 
 extern "C"
 {
+#include <libavutil/frame.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
 #include <libswresample/swresample.h>
 }
 
+// Long-lived resampler for the audio path. The SwrContext and the output
+// buffer survive across frames and are only rebuilt when the input or output
+// format, rate or channel layout changes, so the filter state stays continuous.
 class AudioReSamplingState
 {
 public:
   explicit AudioReSamplingState();
   ~AudioReSamplingState();
 
-  void init(uint64_t channel_layout);
+  // (re)build the context if the parameters differ from the current ones
+  int configure(
+    const AVFrame* frame
+    , const AVSampleFormat& outSampleFmt
+    , const int& outSampleRate
+    , const AVChannelLayout& outChLayout);
+  // convert one frame into outBuf, returns the number of bytes written.
+  // a wantedNbSamples different from the frame's makes swresample stretch or
+  // squeeze the output smoothly over the frame instead of cutting samples.
+  int convert(const AVFrame* frame, const int& wantedNbSamples, uint8_t* outBuf, const int& outBufSize);
+  void release();
 
   SwrContext* swr_ctx;
-  int64_t in_channel_layout;
-  uint64_t out_channel_layout;
-  int out_nb_channels;
+  AVSampleFormat in_sample_fmt;
+  int in_sample_rate;
+  AVChannelLayout in_ch_layout;
+  AVSampleFormat out_sample_fmt;
+  int out_sample_rate;
+  AVChannelLayout out_ch_layout;
   int out_linesize;
-  int in_nb_samples;
-  int64_t out_nb_samples;
   int64_t max_out_nb_samples;
   uint8_t** resampled_data;
   int resampled_data_size;
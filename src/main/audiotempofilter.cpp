@@ -0,0 +1,169 @@
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include "audiotempofilter.h"
+
+using namespace player;
+
+// older atempo builds refuse factors above this, larger ones are chained
+const double ATEMPO_MAX_FACTOR = 2.0;
+const double ATEMPO_MIN_FACTOR = 0.5;
+
+AudioTempoFilter::~AudioTempoFilter()
+{
+  this->release();
+}
+
+int AudioTempoFilter::configure(const AVFrame* frame, const double& tempo)
+{
+  auto sampleFmt = (AVSampleFormat)frame->format;
+
+  // nothing changed, keep the graph and the samples it holds
+  if (m_graph
+      && m_tempo == tempo
+      && m_sampleFmt == sampleFmt
+      && m_sampleRate == frame->sample_rate
+      && av_channel_layout_compare(&m_chLayout, &frame->ch_layout) == 0)
+  {
+    return 0;
+  }
+  this->release();
+
+  m_graph = avfilter_graph_alloc();
+  if (!m_graph)
+  {
+    std::cerr << "avfilter_graph_alloc error." << std::endl;
+    return -1;
+  }
+
+  // source, fed with the decoder output as is
+  char layout[64] = {};
+  av_channel_layout_describe(&frame->ch_layout, layout, sizeof(layout));
+  char args[256] = {};
+  std::snprintf(
+    args
+    , sizeof(args)
+    , "time_base=1/%d:sample_rate=%d:sample_fmt=%s:channel_layout=%s"
+    , frame->sample_rate
+    , frame->sample_rate
+    , av_get_sample_fmt_name(sampleFmt)
+    , layout);
+
+  int ret = avfilter_graph_create_filter(&m_srcCtx, avfilter_get_by_name("abuffer"), "in", args, nullptr, m_graph);
+  if (ret < 0)
+  {
+    std::cerr << "Cannot create audio buffer source." << std::endl;
+    this->release();
+    return -1;
+  }
+
+  ret = avfilter_graph_create_filter(&m_sinkCtx, avfilter_get_by_name("abuffersink"), "out", nullptr, nullptr, m_graph);
+  if (ret < 0)
+  {
+    std::cerr << "Cannot create audio buffer sink." << std::endl;
+    this->release();
+    return -1;
+  }
+
+  // split the factor into atempo stages each within the range every version accepts
+  std::string description;
+  double remaining = tempo;
+  while (remaining > ATEMPO_MAX_FACTOR)
+  {
+    description += "atempo=" + std::to_string(ATEMPO_MAX_FACTOR) + ",";
+    remaining /= ATEMPO_MAX_FACTOR;
+  }
+  while (remaining < ATEMPO_MIN_FACTOR)
+  {
+    description += "atempo=" + std::to_string(ATEMPO_MIN_FACTOR) + ",";
+    remaining /= ATEMPO_MIN_FACTOR;
+  }
+  description += "atempo=" + std::to_string(remaining);
+
+  AVFilterInOut* outputs = avfilter_inout_alloc();
+  AVFilterInOut* inputs = avfilter_inout_alloc();
+  if (!outputs || !inputs)
+  {
+    avfilter_inout_free(&outputs);
+    avfilter_inout_free(&inputs);
+    this->release();
+    return -1;
+  }
+  outputs->name = av_strdup("in");
+  outputs->filter_ctx = m_srcCtx;
+  outputs->pad_idx = 0;
+  outputs->next = nullptr;
+  inputs->name = av_strdup("out");
+  inputs->filter_ctx = m_sinkCtx;
+  inputs->pad_idx = 0;
+  inputs->next = nullptr;
+
+  ret = avfilter_graph_parse_ptr(m_graph, description.c_str(), &inputs, &outputs, nullptr);
+  avfilter_inout_free(&outputs);
+  avfilter_inout_free(&inputs);
+  if (ret < 0)
+  {
+    std::cerr << "Cannot parse audio filter : " << description << std::endl;
+    this->release();
+    return -1;
+  }
+
+  ret = avfilter_graph_config(m_graph, nullptr);
+  if (ret < 0)
+  {
+    std::cerr << "Cannot configure audio filter graph." << std::endl;
+    this->release();
+    return -1;
+  }
+
+  m_tempo = tempo;
+  m_sampleFmt = sampleFmt;
+  m_sampleRate = frame->sample_rate;
+  av_channel_layout_copy(&m_chLayout, &frame->ch_layout);
+
+  return 0;
+}
+
+int AudioTempoFilter::push(AVFrame* frame)
+{
+  if (!m_graph)
+  {
+    return -1;
+  }
+
+  // the source takes over the frame buffers, no copy
+  int ret = av_buffersrc_add_frame(m_srcCtx, frame);
+  if (ret < 0)
+  {
+    std::cerr << "Error while feeding the audio filter graph." << std::endl;
+    return -1;
+  }
+
+  return 0;
+}
+
+int AudioTempoFilter::pull(AVFrame* frame)
+{
+  if (!m_graph)
+  {
+    return AVERROR(EAGAIN);
+  }
+
+  return av_buffersink_get_frame(m_sinkCtx, frame);
+}
+
+void AudioTempoFilter::release()
+{
+  if (m_graph)
+  {
+    // frees every filter context of the graph
+    avfilter_graph_free(&m_graph);
+  }
+  m_srcCtx = nullptr;
+  m_sinkCtx = nullptr;
+  m_tempo = 1.0;
+  m_sampleFmt = AV_SAMPLE_FMT_NONE;
+  m_sampleRate = 0;
+  av_channel_layout_uninit(&m_chLayout);
+}
@@ -0,0 +1,50 @@
+
+#ifndef AUDIO_TEMPO_FILTER_H_
+#define AUDIO_TEMPO_FILTER_H_
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersrc.h>
+#include <libavfilter/buffersink.h>
+}
+
+namespace player
+{
+
+// abuffer -> atempo -> abuffersink graph changing the playback rate of the
+// decoded audio without changing its pitch. The graph is only rebuilt when
+// the tempo or the input format changes.
+class AudioTempoFilter
+{
+public:
+  explicit AudioTempoFilter() = default;
+  ~AudioTempoFilter();
+
+  // (re)build the graph if the parameters differ from the current ones
+  int configure(const AVFrame* frame, const double& tempo);
+  // hand a decoded frame to the graph, frame is left blank
+  int push(AVFrame* frame);
+  // returns AVERROR(EAGAIN) until the graph needs more input
+  int pull(AVFrame* frame);
+  void release();
+
+  bool isConfigured() const { return m_graph != nullptr; }
+  double tempo() const { return m_tempo; }
+
+private:
+  AVFilterGraph* m_graph = nullptr;
+  AVFilterContext* m_srcCtx = nullptr;
+  AVFilterContext* m_sinkCtx = nullptr;
+  double m_tempo = 1.0;
+  AVSampleFormat m_sampleFmt = AV_SAMPLE_FMT_NONE;
+  int m_sampleRate = 0;
+  AVChannelLayout m_chLayout{};
+};
+
+} // player
+
+#endif // AUDIO_TEMPO_FILTER_H_
@@ -0,0 +1,110 @@
+
+#include <cmath>
+#include "clock.h"
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+using namespace player;
+
+Clock::Clock()
+  : m_sequence(0)
+  , m_pts(NAN)
+  , m_lastUpdated(0)
+  , m_speed(1.0)
+  , m_serial(-1)
+{
+}
+
+Clock::Snapshot Clock::snapshot() const
+{
+  Snapshot snapshot;
+  for (;;)
+  {
+    auto sequence = m_sequence.load(std::memory_order_acquire);
+    if (sequence & 1)
+    {
+      // a writer is in the middle of publishing
+      continue;
+    }
+
+    snapshot.pts = m_pts.load(std::memory_order_relaxed);
+    snapshot.lastUpdated = m_lastUpdated.load(std::memory_order_relaxed);
+    snapshot.speed = m_speed.load(std::memory_order_relaxed);
+    snapshot.serial = m_serial.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_sequence.load(std::memory_order_relaxed) == sequence)
+    {
+      return snapshot;
+    }
+  }
+}
+
+double Clock::valueAt(const Snapshot& snapshot, const int64_t& time)
+{
+  double elapsed = (time - snapshot.lastUpdated) / 1000000.0;
+  return snapshot.pts + elapsed * snapshot.speed;
+}
+
+double Clock::get() const
+{
+  return Clock::valueAt(this->snapshot(), av_gettime_relative());
+}
+
+double Clock::get(const int& serial) const
+{
+  auto snapshot = this->snapshot();
+  if (snapshot.serial != serial)
+  {
+    return NAN;
+  }
+
+  return Clock::valueAt(snapshot, av_gettime_relative());
+}
+
+void Clock::set(const double& pts, const int& serial)
+{
+  this->set(pts, serial, av_gettime_relative());
+}
+
+void Clock::set(const double& pts, const int& serial, const int64_t& time)
+{
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+
+  Snapshot snapshot;
+  snapshot.pts = pts;
+  snapshot.lastUpdated = time;
+  snapshot.speed = m_speed.load(std::memory_order_relaxed);
+  snapshot.serial = serial;
+  this->publish(snapshot);
+}
+
+void Clock::setSpeed(const double& speed)
+{
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+
+  auto snapshot = this->snapshot();
+  auto now = av_gettime_relative();
+  if (!std::isnan(snapshot.pts))
+  {
+    snapshot.pts = Clock::valueAt(snapshot, now);
+  }
+  snapshot.lastUpdated = now;
+  snapshot.speed = speed;
+  this->publish(snapshot);
+}
+
+void Clock::publish(const Snapshot& snapshot)
+{
+  // odd while the fields are being written
+  m_sequence.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  m_pts.store(snapshot.pts, std::memory_order_relaxed);
+  m_lastUpdated.store(snapshot.lastUpdated, std::memory_order_relaxed);
+  m_speed.store(snapshot.speed, std::memory_order_relaxed);
+  m_serial.store(snapshot.serial, std::memory_order_relaxed);
+  m_sequence.fetch_add(1, std::memory_order_release);
+}
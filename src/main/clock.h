@@ -0,0 +1,57 @@
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+namespace player
+{
+
+// A media clock : pts at a monotonic time (av_gettime_relative), running at a
+// speed, tagged with the packet serial it was set from. Writers are serialised
+// by a mutex and publish under a sequence counter, readers never block and
+// always see pts, time, speed and serial from the same update.
+class Clock
+{
+public:
+  struct Snapshot
+  {
+    double pts = 0.0;
+    // monotonic time pts was taken at (us)
+    int64_t lastUpdated = 0;
+    double speed = 1.0;
+    int serial = -1;
+  };
+
+  explicit Clock();
+  ~Clock() = default;
+
+  Snapshot snapshot() const;
+  // pts advanced to now, NAN until the clock was set
+  double get() const;
+  // NAN as well when the clock was last set for another serial
+  double get(const int& serial) const;
+  int serial() const { return this->snapshot().serial; }
+
+  void set(const double& pts, const int& serial);
+  void set(const double& pts, const int& serial, const int64_t& time);
+  // keep the current position and continue at the new speed
+  void setSpeed(const double& speed);
+
+private:
+  void publish(const Snapshot& snapshot);
+  static double valueAt(const Snapshot& snapshot, const int64_t& time);
+
+  std::mutex m_writeMutex;
+  std::atomic<uint32_t> m_sequence;
+  std::atomic<double> m_pts;
+  std::atomic<int64_t> m_lastUpdated;
+  std::atomic<double> m_speed;
+  std::atomic_int m_serial;
+};
+
+} // player
+
+#endif // CLOCK_H_
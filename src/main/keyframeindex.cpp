@@ -0,0 +1,226 @@
+
+#include <iostream>
+#include <algorithm>
+#include "keyframeindex.h"
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+using namespace player;
+
+KeyframeIndex::~KeyframeIndex()
+{
+  this->stop();
+}
+
+int KeyframeIndex::start(const std::string& filename, const int& streamIndex, const AVCodecParameters* codecpar)
+{
+  if (m_thread.joinable() || streamIndex < 0 || !codecpar)
+  {
+    return -1;
+  }
+
+  m_abortRequest = false;
+  m_complete = false;
+  auto codecType = codecpar->codec_type;
+  auto codecId = codecpar->codec_id;
+  m_thread = std::thread([this, filename, streamIndex, codecType, codecId]()
+  {
+    this->scanThread(filename, streamIndex, codecType, codecId);
+  });
+  return 0;
+}
+
+void KeyframeIndex::stop()
+{
+  m_abortRequest = true;
+  if (m_thread.joinable())
+  {
+    m_thread.join();
+  }
+}
+
+void KeyframeIndex::load(const std::vector<KeyframeEntry>& entries)
+{
+  this->stop();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries = entries;
+  m_scannedPts = m_entries.empty() ? AV_NOPTS_VALUE : m_entries.back().pts;
+  m_complete = true;
+}
+
+int KeyframeIndex::scanThread(const std::string filename, const int streamIndex, const AVMediaType codecType, const AVCodecID codecId)
+{
+  auto startTime = av_gettime_relative();
+
+  // a context of our own, the player keeps reading through the other one
+  AVFormatContext* formatCtx = nullptr;
+  if (avformat_open_input(&formatCtx, filename.c_str(), nullptr, nullptr) < 0)
+  {
+    std::cerr << "keyframe index : could not open " << filename << std::endl;
+    return -1;
+  }
+
+  // without probing, streams found late (mpeg-ts pmt order) may be numbered
+  // differently than in the player context, never index another stream
+  auto codecpar = (streamIndex < (int)formatCtx->nb_streams) ? formatCtx->streams[streamIndex]->codecpar : nullptr;
+  if (!codecpar || codecpar->codec_type != codecType || codecpar->codec_id != codecId)
+  {
+    std::cerr << "keyframe index : stream " << streamIndex << " of " << filename
+              << " does not match the played stream, not indexing" << std::endl;
+    avformat_close_input(&formatCtx);
+    return -1;
+  }
+
+  // only the packets of the indexed stream are wanted, let the demuxer skip the rest
+  for (unsigned int i = 0; i < formatCtx->nb_streams; i++)
+  {
+    if ((int)i != streamIndex)
+    {
+      formatCtx->streams[i]->discard = AVDISCARD_ALL;
+    }
+  }
+
+  AVPacket* packet = av_packet_alloc();
+  if (!packet)
+  {
+    avformat_close_input(&formatCtx);
+    return -1;
+  }
+
+  int ret = 0;
+  while (!m_abortRequest)
+  {
+    ret = av_read_frame(formatCtx, packet);
+    if (ret < 0)
+    {
+      break;
+    }
+
+    if (packet->stream_index == streamIndex)
+    {
+      auto pts = (packet->pts != AV_NOPTS_VALUE) ? packet->pts : packet->dts;
+      if (pts != AV_NOPTS_VALUE)
+      {
+        if (packet->flags & AV_PKT_FLAG_KEY)
+        {
+          KeyframeEntry entry;
+          entry.pts = pts;
+          entry.pos = packet->pos;
+          this->add(entry);
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_scannedPts == AV_NOPTS_VALUE || pts > m_scannedPts)
+        {
+          m_scannedPts = pts;
+        }
+      }
+    }
+    av_packet_unref(packet);
+  }
+
+  if (ret == AVERROR_EOF)
+  {
+    m_complete = true;
+    std::cout << "keyframe index : " << this->size() << " key frames in "
+              << (av_gettime_relative() - startTime) / 1000 << " ms" << std::endl;
+  }
+
+  av_packet_free(&packet);
+  avformat_close_input(&formatCtx);
+  return 0;
+}
+
+void KeyframeIndex::add(const KeyframeEntry& entry)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  // key frames come in pts order almost always, append in that case
+  if (m_entries.empty() || m_entries.back().pts < entry.pts)
+  {
+    m_entries.push_back(entry);
+    return;
+  }
+
+  auto it = std::lower_bound(m_entries.begin(), m_entries.end(), entry.pts, [](const KeyframeEntry& e, const int64_t& pts)
+  {
+    return e.pts < pts;
+  });
+  if (it == m_entries.end() || it->pts != entry.pts)
+  {
+    m_entries.insert(it, entry);
+  }
+}
+
+bool KeyframeIndex::find(const int64_t& pts, KeyframeEntry& entry) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  // a closer key frame may still be ahead of the scan
+  if (!m_complete && (m_scannedPts == AV_NOPTS_VALUE || pts > m_scannedPts))
+  {
+    return false;
+  }
+
+  auto it = std::upper_bound(m_entries.begin(), m_entries.end(), pts, [](const int64_t& pts, const KeyframeEntry& e)
+  {
+    return pts < e.pts;
+  });
+  if (it == m_entries.begin())
+  {
+    return false;
+  }
+
+  entry = *(--it);
+  return true;
+}
+
+bool KeyframeIndex::findNext(const int64_t& pts, KeyframeEntry& entry) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  auto it = std::upper_bound(m_entries.begin(), m_entries.end(), pts, [](const int64_t& pts, const KeyframeEntry& e)
+  {
+    return pts < e.pts;
+  });
+  if (it == m_entries.end())
+  {
+    return false;
+  }
+
+  entry = *it;
+  return true;
+}
+
+bool KeyframeIndex::findPrevious(const int64_t& pts, KeyframeEntry& entry) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  auto it = std::lower_bound(m_entries.begin(), m_entries.end(), pts, [](const KeyframeEntry& e, const int64_t& pts)
+  {
+    return e.pts < pts;
+  });
+  if (it == m_entries.begin())
+  {
+    return false;
+  }
+
+  entry = *(--it);
+  return true;
+}
+
+size_t KeyframeIndex::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.size();
+}
+
+std::vector<KeyframeEntry> KeyframeIndex::entries() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries;
+}
@@ -0,0 +1,72 @@
+
+#ifndef KEYFRAME_INDEX_H_
+#define KEYFRAME_INDEX_H_
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+namespace player
+{
+
+struct KeyframeEntry
+{
+  // presentation timestamp, in the stream time base
+  int64_t pts = AV_NOPTS_VALUE;
+  // byte offset of the packet in the file, -1 when unknown
+  int64_t pos = -1;
+};
+
+// Key frame table of one video stream, built in the background by reading the
+// packet headers of the file through a second AVFormatContext. Nothing is
+// decoded, so the scan costs about one sequential read of the file.
+class KeyframeIndex
+{
+public:
+  explicit KeyframeIndex() = default;
+  ~KeyframeIndex();
+
+  // codecpar is the one of the player stream, the scan checks it opened the same stream
+  int start(const std::string& filename, const int& streamIndex, const AVCodecParameters* codecpar);
+  void stop();
+  // take a complete table read back from the stream cache instead of scanning
+  void load(const std::vector<KeyframeEntry>& entries);
+
+  // last key frame at or before pts (stream time base). false when the index
+  // cannot tell yet, i.e. pts is past what has been scanned so far
+  bool find(const int64_t& pts, KeyframeEntry& entry) const;
+  // first key frame strictly after pts
+  bool findNext(const int64_t& pts, KeyframeEntry& entry) const;
+  // last key frame strictly before pts
+  bool findPrevious(const int64_t& pts, KeyframeEntry& entry) const;
+
+  bool isComplete() const { return m_complete; }
+  size_t size() const;
+  std::vector<KeyframeEntry> entries() const;
+
+private:
+  int scanThread(const std::string filename, const int streamIndex, const AVMediaType codecType, const AVCodecID codecId);
+  void add(const KeyframeEntry& entry);
+
+  std::thread m_thread;
+  std::atomic_bool m_abortRequest = false;
+  std::atomic_bool m_complete = false;
+
+  mutable std::mutex m_mutex;
+  // sorted by pts
+  std::vector<KeyframeEntry> m_entries;
+  // highest pts scanned so far, key frame or not
+  int64_t m_scannedPts = AV_NOPTS_VALUE;
+};
+
+} // player
+
+#endif // KEYFRAME_INDEX_H_
@@ -6,6 +6,7 @@
 #include <vector>
 #include <string>
 #include <cstdlib>
+#include <stdexcept>
 
 #include "videoreader.h"
 #include "stringhelper.h"
@@ -21,6 +22,13 @@
 
 #undef main
 
+// accepted ranges of the numeric options
+#define OPTION_THREADS_MAX 64
+#define OPTION_PICTURE_QUEUE_SIZE_MAX 64
+#define OPTION_MAX_BUFFER_SECONDS_MAX 3600.0
+#define OPTION_MAX_BUFFER_SIZE_KB_MAX (16 * 1024 * 1024)
+#define OPTION_LIVE_LATENCY_MS_MAX 60000
+
 static inline int getOutputAudioDeviceList(std::vector<std::wstring> &vec)
 {
   int deviceNum = SDL_GetNumAudioDevices(0);
@@ -34,16 +42,83 @@ static inline int getOutputAudioDeviceList(std::vector<std::wstring> &vec)
   return deviceNum;
 }
 
+// whole number within [min, max], false when text is not one or is out of range
+static inline bool parseInteger(const char* text, const int& min, const int& max, int& value)
+{
+  try
+  {
+    std::string str = std::string(text);
+    size_t used = 0;
+    long long number = std::stoll(str, &used);
+    if (used != str.size() || number < min || number > max)
+    {
+      return false;
+    }
+    value = (int)number;
+    return true;
+  }
+  catch (const std::exception&)
+  {
+    return false;
+  }
+}
+
+// number within [min, max], false when text is not one or is out of range
+static inline bool parseReal(const char* text, const double& min, const double& max, double& value)
+{
+  try
+  {
+    std::string str = std::string(text);
+    size_t used = 0;
+    double number = std::stod(str, &used);
+    // written so that nan fails too
+    if (used != str.size() || !(number >= min && number <= max))
+    {
+      return false;
+    }
+    value = number;
+    return true;
+  }
+  catch (const std::exception&)
+  {
+    return false;
+  }
+}
+
 static inline void usage(const std::wstring& wsProgName)
 {
   // Output command line parameter.
   std::wcout << wsProgName
              << " <file path / url>"
              << " <output audio device index>"
+             << " [options]"
              << std::endl;
   std::wcout << "i.e.," << std::endl;
   std::wcout << wsProgName << " /path/to/movie.mp4 1" << std::endl << std::endl;
 
+  // Output options.
+  std::wcout << "----- Options -----" << std::endl;
+  std::wcout << "-threads <n>                      : video decoder threads, 0 = auto (default)" << std::endl;
+  std::wcout << "-thread_type <auto|frame|slice>   : video decoder threading mode" << std::endl;
+  std::wcout << "-pictq <n>                        : decoded pictures buffered ahead of display (default 3)" << std::endl;
+  std::wcout << "-maxbuffer <seconds>              : media buffered ahead of each decoder (default 5, at least 0.1)" << std::endl;
+  std::wcout << "-maxbuffersize <KB>               : bytes buffered ahead of each decoder (default 8192, at least 1)" << std::endl;
+  std::wcout << "-noframedrop                      : show every frame even when it is late" << std::endl;
+  std::wcout << "-sync <audio|video|ext>           : master clock the other streams follow (default audio)" << std::endl;
+  std::wcout << "-speed <rate>                     : playback rate from 0.5 to 4 ([ and ] while playing)" << std::endl;
+  std::wcout << "-live <latency ms>                : live stream, hold the buffer around the latency (e.g. 200)" << std::endl;
+  std::wcout << "-lowlatency                       : camera feed profile, show the newest frame as soon as possible" << std::endl;
+  std::wcout << "-exact                            : seek to the exact position instead of the nearest key frame" << std::endl;
+  std::wcout << "-nocache                          : do not read or write the .pidx stream info sidecar" << std::endl;
+  std::wcout << "-cachebeside                      : keep the .pidx sidecar next to the media file, not in the user cache directory" << std::endl << std::endl;
+
+  // Output keys.
+  std::wcout << "----- Keys -----" << std::endl;
+  std::wcout << "left / right, down / up           : seek 10 s / 60 s" << std::endl;
+  std::wcout << "[ / ] / backspace                 : slower / faster / normal playback speed" << std::endl;
+  std::wcout << "j / l                             : rewind / fast forward, 2x to 16x, again to double" << std::endl;
+  std::wcout << "k                                 : back to normal playback" << std::endl << std::endl;
+
   // Get audio output devices.
   std::vector<std::wstring> vecAudioOutDevNames;
   std::wcout << "----- Audio Output Devices -----" << std::endl;
@@ -75,7 +150,7 @@ int main(int argc, char *argv[])
 
   std::string progName = std::string(argv[0]);
   std::wstring wsProgName = stringHelper::stringToWstring(progName);
-  if (argc != 3)
+  if (argc < 3)
   {
     usage(wsProgName);
     return -1;
@@ -83,8 +158,8 @@ int main(int argc, char *argv[])
 
   std::vector<std::wstring> vecAudioOutDevNames;
   int deviceNum = getOutputAudioDeviceList(vecAudioOutDevNames);
-  int outputAudioDevIndex = std::stoi(argv[2]);
-  if (deviceNum < outputAudioDevIndex)
+  int outputAudioDevIndex = -1;
+  if (!parseInteger(argv[2], 0, deviceNum, outputAudioDevIndex))
   {
     std::cerr << "Failed to input audio output device number." << std::endl;
     usage(wsProgName);
@@ -92,6 +167,181 @@ int main(int argc, char *argv[])
   }
 
   std::unique_ptr<player::VideoReader> videoReader = std::make_unique<player::VideoReader>();
+
+  // Parse options.
+  int decoderThreadCount = 0;
+  player::DECODE_THREAD_TYPE decoderThreadType = player::DECODE_THREAD_TYPE::AUTO;
+  double maxPacketReadSeconds = MAX_STREAM_PACKET_READ_DURATION;
+  int64_t maxPacketReadSize = MAX_STREAM_PACKET_READ_SIZE;
+  int pictureQueueSize = -1;
+  int liveLatencyMs = -1;
+  bool lowLatency = false;
+  bool hasSyncType = false;
+  player::SYNC_TYPE syncType = player::SYNC_TYPE::AV_SYNC_AUDIO_MASTER;
+  for (int i = 3; i < argc; i++)
+  {
+    std::string option = std::string(argv[i]);
+    bool hasValue = (i + 1 < argc);
+    if (option == "-threads" && hasValue)
+    {
+      if (!parseInteger(argv[++i], 0, OPTION_THREADS_MAX, decoderThreadCount))
+      {
+        std::cerr << "Invalid thread count : " << argv[i] << std::endl;
+        usage(wsProgName);
+        return -1;
+      }
+    }
+    else if (option == "-thread_type" && hasValue)
+    {
+      std::string value = std::string(argv[++i]);
+      if (value == "auto")
+      {
+        decoderThreadType = player::DECODE_THREAD_TYPE::AUTO;
+      }
+      else if (value == "frame")
+      {
+        decoderThreadType = player::DECODE_THREAD_TYPE::FRAME;
+      }
+      else if (value == "slice")
+      {
+        decoderThreadType = player::DECODE_THREAD_TYPE::SLICE;
+      }
+      else
+      {
+        std::cerr << "Unknown thread type : " << value << std::endl;
+        usage(wsProgName);
+        return -1;
+      }
+    }
+    else if (option == "-pictq" && hasValue)
+    {
+      if (!parseInteger(argv[++i], 1, OPTION_PICTURE_QUEUE_SIZE_MAX, pictureQueueSize))
+      {
+        std::cerr << "Invalid picture queue size : " << argv[i] << std::endl;
+        usage(wsProgName);
+        return -1;
+      }
+    }
+    else if (option == "-maxbuffer" && hasValue)
+    {
+      if (!parseReal(argv[++i], MIN_STREAM_PACKET_READ_DURATION, OPTION_MAX_BUFFER_SECONDS_MAX, maxPacketReadSeconds))
+      {
+        std::cerr << "Invalid buffer duration : " << argv[i] << std::endl;
+        usage(wsProgName);
+        return -1;
+      }
+    }
+    else if (option == "-maxbuffersize" && hasValue)
+    {
+      int maxPacketReadSizeKB = 0;
+      if (!parseInteger(argv[++i], MIN_STREAM_PACKET_READ_SIZE / 1024, OPTION_MAX_BUFFER_SIZE_KB_MAX, maxPacketReadSizeKB))
+      {
+        std::cerr << "Invalid buffer size : " << argv[i] << std::endl;
+        usage(wsProgName);
+        return -1;
+      }
+      maxPacketReadSize = (int64_t)maxPacketReadSizeKB * 1024;
+    }
+    else if (option == "-noframedrop")
+    {
+      videoReader->setFrameDrop(false);
+    }
+    else if (option == "-speed" && hasValue)
+    {
+      double speed = 1.0;
+      if (!parseReal(argv[++i], PLAYBACK_SPEED_MIN, PLAYBACK_SPEED_MAX, speed))
+      {
+        std::cerr << "Invalid playback speed : " << argv[i] << std::endl;
+        usage(wsProgName);
+        return -1;
+      }
+      videoReader->setPlaybackSpeed(speed);
+    }
+    else if (option == "-lowlatency")
+    {
+      lowLatency = true;
+    }
+    else if (option == "-exact")
+    {
+      videoReader->setExactSeek(true);
+    }
+    else if (option == "-nocache")
+    {
+      videoReader->setStreamCache(false);
+    }
+    else if (option == "-cachebeside")
+    {
+      videoReader->setStreamCacheBesideMedia(true);
+    }
+    else if (option == "-live" && hasValue)
+    {
+      // a latency of 0 or below would silently leave live mode off
+      if (!parseInteger(argv[++i], 1, OPTION_LIVE_LATENCY_MS_MAX, liveLatencyMs))
+      {
+        std::cerr << "Invalid live latency, expected 1 to 60000 ms : " << argv[i] << std::endl;
+        usage(wsProgName);
+        return -1;
+      }
+    }
+    else if (option == "-sync" && hasValue)
+    {
+      std::string value = std::string(argv[++i]);
+      hasSyncType = true;
+      if (value == "audio")
+      {
+        syncType = player::SYNC_TYPE::AV_SYNC_AUDIO_MASTER;
+      }
+      else if (value == "video")
+      {
+        syncType = player::SYNC_TYPE::AV_SYNC_VIDEO_MASTER;
+      }
+      else if (value == "ext")
+      {
+        syncType = player::SYNC_TYPE::AV_SYNC_EXTERNAL_MASTER;
+      }
+      else
+      {
+        std::cerr << "Unknown sync type : " << value << std::endl;
+        usage(wsProgName);
+        return -1;
+      }
+    }
+    else
+    {
+      std::cerr << "Unknown option : " << option << std::endl;
+      usage(wsProgName);
+      return -1;
+    }
+  }
+
+  // live playback steers the external clock, any other master clock would switch it off
+  bool live = (liveLatencyMs >= 0 || lowLatency);
+  if (live && hasSyncType && syncType != player::SYNC_TYPE::AV_SYNC_EXTERNAL_MASTER)
+  {
+    std::cerr << "-live and -lowlatency need the external clock, they cannot be used with -sync audio or -sync video" << std::endl;
+    usage(wsProgName);
+    return -1;
+  }
+  if (hasSyncType)
+  {
+    videoReader->setSyncType(syncType);
+  }
+  if (liveLatencyMs >= 0)
+  {
+    videoReader->setLiveMode(true, liveLatencyMs / 1000.0);
+  }
+  if (lowLatency)
+  {
+    videoReader->setLowLatency(true);
+  }
+  if (pictureQueueSize >= 0)
+  {
+    // an explicit -pictq wins over the low latency profile
+    videoReader->setPictureQueueSize(pictureQueueSize);
+  }
+  videoReader->setDecoderThreads(decoderThreadCount, decoderThreadType);
+  videoReader->setPacketReadLimits(maxPacketReadSeconds, maxPacketReadSize);
+
   std::string filename = std::string(argv[1]);
   videoReader->start(filename, outputAudioDevIndex);
   while(1)
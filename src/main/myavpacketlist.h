@@ -15,6 +15,8 @@ struct MyAVPacketList
 {
   AVPacket* pkt = nullptr;
   int frameNumber = 0;
+  // queue serial at push time, bumped by PacketQueue::flush()
+  int serial = 0;
 };
 
 } // player
@@ -1,128 +1,254 @@
 
+#include <chrono>
 #include "packetqueue.h"
 
 using namespace player;
 
-PacketQueue::PacketQueue()
-  : m_nbPackets(0)
-  , m_size(0)
+PacketQueue::PacketQueue(const int& capacity)
+  : m_capacity(1)
+  , m_mask(0)
+  , m_writeIndex(0)
+  , m_readIndex(0)
+  , m_discardIndex(0)
   , m_frameNumber(0)
+  , m_serial(0)
+  , m_size(0)
+  , m_nbPackets(0)
+  , m_duration(0)
+  , m_timeBase{1, AV_TIME_BASE}
+  , m_abortRequest(false)
+  , m_waiters(0)
+  , m_packetAllocs(0)
+  , m_pushed(0)
+  , m_popped(0)
+  , m_discarded(0)
+  , m_rejected(0)
+  , m_highWater(0)
 {
+  // round the capacity up to a power of two so that the slot index is a mask
+  while (m_capacity < capacity)
+  {
+    m_capacity <<= 1;
+  }
+  m_mask = m_capacity - 1;
+
+  // allocate every packet shell up front, push/pop only move references
+  m_slots.resize(m_capacity);
+  for (auto& slot : m_slots)
+  {
+    slot.pkt = av_packet_alloc();
+    m_packetAllocs++;
+  }
 }
 
 PacketQueue::~PacketQueue()
 {
-  if (m_nbPackets > 0)
+  // no producer or consumer is left, so release the slots directly
+  for (auto& slot : m_slots)
   {
-    this->clear();
+    if (slot.pkt)
+    {
+      av_packet_free(&slot.pkt);
+    }
   }
 }
+
 void PacketQueue::init()
 {
   this->clear();
 }
 
+bool PacketQueue::isFull() const
+{
+  auto used = m_writeIndex.load(std::memory_order_acquire) - m_readIndex.load(std::memory_order_acquire);
+
+  return used >= (uint64_t)m_capacity;
+}
+
+PacketQueueStats PacketQueue::stats() const
+{
+  PacketQueueStats stats;
+  stats.packetAllocs = m_packetAllocs;
+  stats.pushed = m_pushed;
+  stats.popped = m_popped;
+  stats.discarded = m_discarded;
+  stats.rejected = m_rejected;
+  stats.highWater = m_highWater;
+  return stats;
+}
+
 int PacketQueue::push(AVPacket* packet)
 {
-  // Lock mutex
-  std::lock_guard<std::mutex> lock(m_mutex);
+  if (packet == nullptr)
+  {
+    return -1;
+  }
+
+  auto writeIndex = m_writeIndex.load(std::memory_order_relaxed);
+  auto readIndex = m_readIndex.load(std::memory_order_acquire);
+  if (writeIndex - readIndex >= (uint64_t)m_capacity)
+  {
+    // the ring is full, the caller keeps ownership of the packet
+    m_rejected++;
+    return -1;
+  }
 
-  MyAVPacketList* avPacketList = new MyAVPacketList();
-  avPacketList->pkt = av_packet_alloc();
+  auto& slot = m_slots[writeIndex & m_mask];
 
   // Move reference to the given AVPacket
-  av_packet_move_ref(avPacketList->pkt, packet);
+  av_packet_move_ref(slot.pkt, packet);
 
   // Increase by 1 the number of frame.
   m_frameNumber++;
 
   // Set frame number
-  avPacketList->frameNumber = m_frameNumber;
-
-  // Push to queue
-  m_myAvPacketListQueue.push(avPacketList);
+  slot.frameNumber = m_frameNumber;
+  slot.serial = m_serial;
 
   // Increase by 1 the number of AVPackets in the queue
-  m_nbPackets++;
+  int nbPackets = ++m_nbPackets;
+  if (nbPackets > m_highWater.load(std::memory_order_relaxed))
+  {
+    m_highWater.store(nbPackets, std::memory_order_relaxed);
+  }
+  m_pushed++;
 
   // Increase queue size by adding the size of the newly inserted AVPacket
-  m_size += avPacketList->pkt->size;
+  m_size += slot.pkt->size;
+  m_duration += slot.pkt->duration;
 
-  // notify packet_queue_get which is waiting that a new packet is available
-  m_cond.notify_all();
+  // publish the slot to the consumer
+  m_writeIndex.store(writeIndex + 1, std::memory_order_release);
+
+  // notify pop() which is waiting that a new packet is available
+  this->wakeConsumer();
 
   return 0;
 }
 
-int PacketQueue::pop(AVPacket* packet)
+int PacketQueue::pop(AVPacket* packet, const int& timeoutMs, int* serial)
 {
-  int ret = -1;
-
-  // Lock mutex
-  std::unique_lock<std::mutex> lock(m_mutex);
-
-  if (m_myAvPacketListQueue.empty() || m_nbPackets <= 0)
+  int ret = this->tryPop(packet, serial);
+  if (ret >= 0 || timeoutMs <= 0)
   {
     return ret;
   }
 
-  auto myAvPacketList = m_myAvPacketListQueue.front();
-  if (myAvPacketList)
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+  for (;;)
   {
-    // Decrease the number of packets in the queue
-    m_nbPackets--;
+    if (m_abortRequest)
+    {
+      return -1;
+    }
+
+    {
+      // register as a waiter before checking the ring under the lock, so a
+      // concurrent push() either sees us or we see its packet
+      m_waiters++;
+      std::unique_lock<std::mutex> lock(m_mutex);
+      bool ready = m_cond.wait_until(lock, deadline, [this]
+      {
+        return m_abortRequest || m_readIndex.load() != m_writeIndex.load();
+      });
+      m_waiters--;
+
+      if (!ready)
+      {
+        // timed out
+        return -1;
+      }
+    }
+
+    // the ring may only contain cleared packets, in that case wait again
+    ret = this->tryPop(packet, serial);
+    if (ret >= 0)
+    {
+      return ret;
+    }
+  }
+}
 
-    // Decrease the size of the packets in the queue
-    m_size -= myAvPacketList->pkt->size;
+int PacketQueue::tryPop(AVPacket* packet, int* serial)
+{
+  auto readIndex = m_readIndex.load(std::memory_order_relaxed);
+  auto discardIndex = m_discardIndex.load(std::memory_order_acquire);
 
-    // 
-    av_packet_move_ref(packet, myAvPacketList->pkt);
+  for (;;)
+  {
+    auto writeIndex = m_writeIndex.load(std::memory_order_acquire);
+    if (readIndex == writeIndex)
+    {
+      return -1;
+    }
 
-    // Set to ret value that the return value of frame number
-    ret = myAvPacketList->frameNumber;
+    auto& slot = m_slots[readIndex & m_mask];
 
-    // Release packet
-    av_packet_unref(myAvPacketList->pkt);
-    av_packet_free(&myAvPacketList->pkt);
+    // Decrease the number of packets in the queue
+    m_nbPackets--;
 
-    // Release pointer
-    delete myAvPacketList;
+    // Decrease the size of the packets in the queue
+    m_size -= slot.pkt->size;
+    m_duration -= slot.pkt->duration;
+
+    if (readIndex < discardIndex)
+    {
+      // the packet was cleared by the producer, drop it here
+      av_packet_unref(slot.pkt);
+      m_discarded++;
+      m_readIndex.store(++readIndex, std::memory_order_release);
+      continue;
+    }
+
+    av_packet_move_ref(packet, slot.pkt);
+    int ret = slot.frameNumber;
+    if (serial)
+    {
+      *serial = slot.serial;
+    }
+    m_popped++;
+
+    // hand the slot back to the producer
+    m_readIndex.store(readIndex + 1, std::memory_order_release);
 
-    // Pop
-    m_myAvPacketListQueue.pop();
-  }
-  else
-  {
-    // unlock mutex and wait for cond signal, then lock mutex again
-    m_cond.wait(lock);
+    return ret;
   }
-  return ret;
 }
 
 void PacketQueue::clear()
 {
-  // Lock mutex
-  std::unique_lock<std::mutex> lock(m_mutex);
-
-  while (!m_myAvPacketListQueue.empty() && m_nbPackets > 0)
-  {
-    MyAVPacketList* avPacketList = m_myAvPacketListQueue.front();
+  // Only the consumer may touch queued slots, so mark everything written so far
+  // as stale and let the next pop() release it.
+  m_discardIndex.store(m_writeIndex.load(std::memory_order_acquire), std::memory_order_release);
 
-    // Decrease the number of packets in the queue
-    m_nbPackets--;
+  // wake the consumer so it drops the stale packets right away
+  this->wakeConsumer();
+}
 
-    // Decrease the size of the packets in the queue
-    m_size -= avPacketList->pkt->size;
+int PacketQueue::flush()
+{
+  // drop what is queued and start a new serial, consumers compare the serial of
+  // the packets and frames they hold against it to discard stale work
+  this->clear();
+  return ++m_serial;
+}
 
-    // Release
-    av_packet_unref(avPacketList->pkt);
-    av_packet_free(&avPacketList->pkt);
+void PacketQueue::abort()
+{
+  m_abortRequest = true;
 
-    // Release pointer
-    delete avPacketList;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_cond.notify_all();
+}
 
-    // pop
-    m_myAvPacketListQueue.pop();
+void PacketQueue::wakeConsumer()
+{
+  // pairs with the waiter registration in pop()
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_waiters.load() > 0)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cond.notify_one();
   }
 }
 
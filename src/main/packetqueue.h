@@ -9,36 +9,98 @@ extern "C"
 }
 
 #include "myavpacketlist.h"
-#include <queue>
+#include <vector>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <cstdint>
+
+// number of preallocated packet slots per queue (rounded up to a power of two)
+#define PACKET_QUEUE_CAPACITY 4096
 
 namespace player
 {
 
+struct PacketQueueStats
+{
+  // packet shells allocated by the queue, constant once the ring is built
+  uint64_t packetAllocs = 0;
+  uint64_t pushed = 0;
+  uint64_t popped = 0;
+  // packets released by the consumer after a clear()
+  uint64_t discarded = 0;
+  // pushes refused because the ring was full
+  uint64_t rejected = 0;
+  // largest number of packets held at once
+  int highWater = 0;
+};
+
+// Bounded single-producer / single-consumer ring of preallocated packet slots.
+// push() is only called by the demuxer thread and pop() only by the decoder
+// (or the audio callback), so neither side takes a lock. A consumer that asks
+// for a timeout sleeps on the condition variable, which is only signalled when
+// somebody is actually waiting.
 class PacketQueue
 {
 public:
-  explicit PacketQueue();
+  explicit PacketQueue(const int& capacity = PACKET_QUEUE_CAPACITY);
   ~PacketQueue();
 
   void init();
   int push(AVPacket* packet);
-  int pop(AVPacket* packet);
+  // returns -1 when no packet arrived within timeoutMs or the queue was aborted.
+  // serial receives the queue serial the packet was pushed with.
+  int pop(AVPacket* packet, const int& timeoutMs = 0, int* serial = nullptr);
   void clear();
+  int flush();
+  int serial() const { return m_serial; }
+  void abort();
+  bool isAborted() const { return m_abortRequest; }
 
   int size() const { return m_size; }
   int nbPackets() const { return m_nbPackets; }
+  int64_t duration() const { return m_duration; }
+  double durationSeconds() const { return m_duration * av_q2d(m_timeBase); }
+  void setTimeBase(const AVRational& timeBase) { m_timeBase = timeBase; }
+  int capacity() const { return m_capacity; }
+  bool isFull() const;
+  PacketQueueStats stats() const;
 
 private:
-  std::queue<MyAVPacketList*> m_myAvPacketListQueue;
+  int tryPop(AVPacket* packet, int* serial);
+  void wakeConsumer();
+
+  std::vector<MyAVPacketList> m_slots;
+  int m_capacity;
+  uint64_t m_mask;
+  // advanced by the producer only
+  std::atomic<uint64_t> m_writeIndex;
+  // advanced by the consumer only
+  std::atomic<uint64_t> m_readIndex;
+  // slots below this index were cleared and are dropped by the consumer
+  std::atomic<uint64_t> m_discardIndex;
   int m_frameNumber;
-  int m_size;
-  int m_nbPackets;
+  std::atomic_int m_serial;
+  std::atomic_int m_size;
+  std::atomic_int m_nbPackets;
+  // sum of the queued packet durations, in m_timeBase units
+  std::atomic<int64_t> m_duration;
+  AVRational m_timeBase;
+  std::atomic_bool m_abortRequest;
+  std::atomic_int m_waiters;
   std::mutex m_mutex;
   std::condition_variable m_cond;
+
+  // counters
+  std::atomic<uint64_t> m_packetAllocs;
+  std::atomic<uint64_t> m_pushed;
+  std::atomic<uint64_t> m_popped;
+  std::atomic<uint64_t> m_discarded;
+  std::atomic<uint64_t> m_rejected;
+  std::atomic_int m_highWater;
 };
 
 } // player
 
 #endif // PACKET_QUEUE_H_
+
@@ -0,0 +1,149 @@
+
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include "pcmringbuffer.h"
+
+using namespace player;
+
+PcmRingBuffer::PcmRingBuffer(const int& capacity)
+  : m_capacity(1)
+  , m_mask(0)
+  , m_sequence(0)
+  , m_writePos(0)
+  , m_serialStartPos(0)
+  , m_endPts(0.0)
+  , m_serial(-1)
+  , m_readPos(0)
+  , m_writerWaiting(false)
+{
+  // round the capacity up to a power of two so that positions wrap with a mask
+  while (m_capacity < capacity)
+  {
+    m_capacity <<= 1;
+  }
+  m_mask = m_capacity - 1;
+  m_buffer.resize(m_capacity);
+}
+
+int64_t PcmRingBuffer::fill() const
+{
+  auto writePos = m_writePos.load(std::memory_order_acquire);
+  auto readPos = m_readPos.load(std::memory_order_acquire);
+  return (readPos < writePos) ? (int64_t)(writePos - readPos) : 0;
+}
+
+int PcmRingBuffer::write(const uint8_t* data, const int& size, const double& endPts, const int& serial)
+{
+  auto writePos = m_writePos.load(std::memory_order_relaxed);
+  auto readPos = m_readPos.load(std::memory_order_acquire);
+  if (size <= 0 || writePos - readPos + size > (uint64_t)m_capacity)
+  {
+    return -1;
+  }
+
+  // copy in at most two pieces around the end of the buffer
+  auto offset = (size_t)(writePos & m_mask);
+  auto first = std::min((size_t)size, (size_t)m_capacity - offset);
+  std::memcpy(m_buffer.data() + offset, data, first);
+  if (first < (size_t)size)
+  {
+    std::memcpy(m_buffer.data(), data + first, size - first);
+  }
+
+  // the first samples of a new serial mark where the stale data ends
+  auto serialStartPos = m_serialStartPos.load(std::memory_order_relaxed);
+  if (serial != m_serial.load(std::memory_order_relaxed))
+  {
+    serialStartPos = writePos;
+  }
+
+  // publish position, pts and serial together
+  m_sequence.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  m_serialStartPos.store(serialStartPos, std::memory_order_relaxed);
+  m_endPts.store(endPts, std::memory_order_relaxed);
+  m_serial.store(serial, std::memory_order_relaxed);
+  m_writePos.store(writePos + size, std::memory_order_relaxed);
+  m_sequence.fetch_add(1, std::memory_order_release);
+
+  return 0;
+}
+
+void PcmRingBuffer::waitBelow(const int64_t& fill, const int& timeoutMs)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_writerWaiting = true;
+  m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, fill]
+  {
+    return this->fill() < fill;
+  });
+  m_writerWaiting = false;
+}
+
+PcmRingBuffer::Snapshot PcmRingBuffer::snapshot() const
+{
+  Snapshot snapshot;
+  for (;;)
+  {
+    auto sequence = m_sequence.load(std::memory_order_acquire);
+    if (sequence & 1)
+    {
+      // the producer is in the middle of publishing
+      continue;
+    }
+
+    snapshot.writePos = m_writePos.load(std::memory_order_relaxed);
+    snapshot.serialStartPos = m_serialStartPos.load(std::memory_order_relaxed);
+    snapshot.endPts = m_endPts.load(std::memory_order_relaxed);
+    snapshot.serial = m_serial.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_sequence.load(std::memory_order_relaxed) == sequence)
+    {
+      return snapshot;
+    }
+  }
+}
+
+int PcmRingBuffer::read(uint8_t* dst, const int& size, const int& serial, double& endPts, int64_t& buffered)
+{
+  auto snapshot = this->snapshot();
+  auto readPos = m_readPos.load(std::memory_order_relaxed);
+
+  if (snapshot.serial != serial)
+  {
+    // everything in the ring predates the latest seek
+    readPos = snapshot.writePos;
+  }
+  else if (readPos < snapshot.serialStartPos)
+  {
+    // skip the samples written before the current serial started
+    readPos = snapshot.serialStartPos;
+  }
+
+  auto available = snapshot.writePos - readPos;
+  auto length = std::min((uint64_t)std::max(size, 0), available);
+
+  // copy out in at most two pieces around the end of the buffer
+  auto offset = (size_t)(readPos & m_mask);
+  auto first = std::min((size_t)length, (size_t)m_capacity - offset);
+  std::memcpy(dst, m_buffer.data() + offset, first);
+  if (first < length)
+  {
+    std::memcpy(dst + first, m_buffer.data(), length - first);
+  }
+  readPos += length;
+
+  // hand the bytes back to the producer
+  m_readPos.store(readPos, std::memory_order_release);
+  if (m_writerWaiting)
+  {
+    // the callback never takes the lock, a lost wakeup is covered by the wait timeout
+    m_cond.notify_one();
+  }
+
+  endPts = snapshot.endPts;
+  buffered = (int64_t)(snapshot.writePos - readPos);
+  return (snapshot.serial == serial) ? (int)length : 0;
+}
@@ -0,0 +1,73 @@
+
+#ifndef PCM_RING_BUFFER_H_
+#define PCM_RING_BUFFER_H_
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+// default ring size in bytes (rounded up to a power of two)
+#define PCM_RING_BUFFER_CAPACITY (512 * 1024)
+
+namespace player
+{
+
+// Single-producer / single-consumer byte ring between the audio decode thread
+// and the SDL audio callback. The callback never blocks or allocates: it only
+// copies bytes out and reads a snapshot of the pts and serial published with
+// the last write.
+class PcmRingBuffer
+{
+public:
+  explicit PcmRingBuffer(const int& capacity = PCM_RING_BUFFER_CAPACITY);
+  ~PcmRingBuffer() = default;
+
+  // producer side. endPts is the pts right after the written samples, serial
+  // the packet serial they were decoded from. returns -1 when there is no room.
+  int write(const uint8_t* data, const int& size, const double& endPts, const int& serial);
+  // sleep until fewer than fill bytes are buffered, or timeoutMs elapsed
+  void waitBelow(const int64_t& fill, const int& timeoutMs);
+
+  // consumer side. data older than the given serial is skipped, endPts and
+  // buffered receive the pts at the write position and the bytes left behind
+  // the read position, so the caller can compute the pts it is playing.
+  int read(uint8_t* dst, const int& size, const int& serial, double& endPts, int64_t& buffered);
+
+  int capacity() const { return m_capacity; }
+  int64_t fill() const;
+  int64_t freeSpace() const { return m_capacity - this->fill(); }
+
+private:
+  struct Snapshot
+  {
+    uint64_t writePos = 0;
+    uint64_t serialStartPos = 0;
+    double endPts = 0.0;
+    int serial = -1;
+  };
+  Snapshot snapshot() const;
+
+  std::vector<uint8_t> m_buffer;
+  int m_capacity;
+  uint64_t m_mask;
+
+  // published by the producer under a sequence lock
+  std::atomic<uint32_t> m_sequence;
+  std::atomic<uint64_t> m_writePos;
+  std::atomic<uint64_t> m_serialStartPos;
+  std::atomic<double> m_endPts;
+  std::atomic_int m_serial;
+
+  // advanced by the consumer only
+  std::atomic<uint64_t> m_readPos;
+
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::atomic_bool m_writerWaiting;
+};
+
+} // player
+
+#endif // PCM_RING_BUFFER_H_
@@ -0,0 +1,781 @@
+
+#include <iostream>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include "streamcache.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <aclapi.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // _WIN32
+
+using namespace player;
+
+namespace
+{
+
+// every field is 64 bits wide so the records have no padding and the file reads
+// back the same on every compiler. the byte order is the one of the host
+struct FileHeader
+{
+  char magic[8];
+  int64_t version;
+  int64_t fileSize;
+  int64_t fileTime;
+  int64_t pathSize;
+  int64_t nbStreams;
+  int64_t startTime;
+  int64_t duration;
+  int64_t bitRate;
+  int64_t keyframeStream;
+  int64_t indexComplete;
+  int64_t nbKeyframes;
+};
+
+// followed by extradataSize bytes of extradata
+struct StreamRecord
+{
+  int64_t codecType;
+  int64_t codecId;
+  int64_t codecTag;
+  int64_t format;
+  int64_t bitRate;
+  int64_t bitsPerCodedSample;
+  int64_t bitsPerRawSample;
+  int64_t profile;
+  int64_t level;
+  int64_t width;
+  int64_t height;
+  int64_t sampleAspectNum;
+  int64_t sampleAspectDen;
+  int64_t fieldOrder;
+  int64_t colorRange;
+  int64_t colorPrimaries;
+  int64_t colorTrc;
+  int64_t colorSpace;
+  int64_t chromaLocation;
+  int64_t videoDelay;
+  int64_t channelOrder;
+  int64_t nbChannels;
+  int64_t channelMask;
+  int64_t sampleRate;
+  int64_t blockAlign;
+  int64_t frameSize;
+  int64_t initialPadding;
+  int64_t trailingPadding;
+  int64_t seekPreroll;
+  int64_t timeBaseNum;
+  int64_t timeBaseDen;
+  int64_t avgFrameRateNum;
+  int64_t avgFrameRateDen;
+  int64_t realFrameRateNum;
+  int64_t realFrameRateDen;
+  int64_t streamAspectNum;
+  int64_t streamAspectDen;
+  int64_t startTime;
+  int64_t duration;
+  int64_t nbFrames;
+  int64_t extradataSize;
+};
+
+struct KeyframeRecord
+{
+  int64_t pts;
+  int64_t pos;
+};
+
+const char STREAM_CACHE_MAGIC[8] = { 'P', 'L', 'A', 'Y', 'I', 'D', 'X', '\0' };
+
+#ifdef _WIN32
+// true when the opened file belongs to the user running the player
+static inline bool ownedByCurrentUser(HANDLE file)
+{
+  PSID owner = nullptr;
+  PSECURITY_DESCRIPTOR descriptor = nullptr;
+  if (GetSecurityInfo(file, SE_FILE_OBJECT, OWNER_SECURITY_INFORMATION, &owner, nullptr, nullptr, nullptr, &descriptor) != ERROR_SUCCESS)
+  {
+    return false;
+  }
+
+  bool owned = false;
+  HANDLE token = nullptr;
+  if (OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+  {
+    DWORD size = 0;
+    GetTokenInformation(token, TokenUser, nullptr, 0, &size);
+    std::vector<uint8_t> info(size);
+    if (size > 0 && GetTokenInformation(token, TokenUser, info.data(), size, &size))
+    {
+      owned = EqualSid(owner, ((TOKEN_USER*)info.data())->User.Sid) != FALSE;
+    }
+    CloseHandle(token);
+  }
+  LocalFree(descriptor);
+  return owned;
+}
+#endif // _WIN32
+
+// read only view of a whole file, only mapped when the current user owns it
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string& path)
+  {
+#ifdef _WIN32
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE || !ownedByCurrentUser(m_file))
+    {
+      return;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart <= 0)
+    {
+      return;
+    }
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping == nullptr)
+    {
+      return;
+    }
+    m_data = (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    m_size = m_data ? (size_t)size.QuadPart : 0;
+#else
+    m_fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW);
+    if (m_fd < 0)
+    {
+      return;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid() || st.st_size <= 0)
+    {
+      return;
+    }
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (data == MAP_FAILED)
+    {
+      return;
+    }
+    m_data = (const uint8_t*)data;
+    m_size = (size_t)st.st_size;
+#endif // _WIN32
+  }
+
+  ~MappedFile()
+  {
+#ifdef _WIN32
+    if (m_data)
+    {
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping)
+    {
+      CloseHandle(m_mapping);
+    }
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(m_file);
+    }
+#else
+    if (m_data)
+    {
+      munmap((void*)m_data, m_size);
+    }
+    if (m_fd >= 0)
+    {
+      close(m_fd);
+    }
+#endif // _WIN32
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const uint8_t* data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+private:
+  const uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+#ifdef _WIN32
+  HANDLE m_file = INVALID_HANDLE_VALUE;
+  HANDLE m_mapping = nullptr;
+#else
+  int m_fd = -1;
+#endif // _WIN32
+};
+
+// bounds checked cursor over the mapped bytes
+class Cursor
+{
+public:
+  Cursor(const uint8_t* data, const size_t& size) : m_data(data), m_size(size) {}
+
+  bool read(void* dst, const size_t& size)
+  {
+    if (size > m_size - m_pos)
+    {
+      return false;
+    }
+    memcpy(dst, m_data + m_pos, size);
+    m_pos += size;
+    return true;
+  }
+
+  size_t remaining() const { return m_size - m_pos; }
+
+  // view of the next size bytes, nullptr past the end
+  const uint8_t* skip(const size_t& size)
+  {
+    if (size > m_size - m_pos)
+    {
+      return nullptr;
+    }
+    auto ptr = m_data + m_pos;
+    m_pos += size;
+    return ptr;
+  }
+
+private:
+  const uint8_t* m_data;
+  size_t m_size;
+  size_t m_pos = 0;
+};
+
+template <typename T>
+static inline void append(std::vector<uint8_t>& buffer, const T& value)
+{
+  auto bytes = (const uint8_t*)&value;
+  buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+// the codec parameter enums are plain ints in the file
+template <typename T>
+static inline void assign(T& dst, const int64_t& value)
+{
+  dst = static_cast<T>(value);
+}
+
+static inline std::string absolutePath(const std::string& filename)
+{
+  std::error_code ec;
+  auto path = std::filesystem::absolute(filename, ec);
+  return ec ? filename : path.string();
+}
+
+// per user cache directory only its owner can write to, empty when there is none.
+// $XDG_CACHE_HOME (~/.cache) or %LOCALAPPDATA%
+static inline std::string cacheDirectory()
+{
+  std::error_code ec;
+#ifdef _WIN32
+  const char* localAppData = getenv("LOCALAPPDATA");
+  if (!localAppData || !localAppData[0])
+  {
+    return "";
+  }
+  auto dir = std::filesystem::path(localAppData) / STREAM_CACHE_DIRECTORY;
+  std::filesystem::create_directories(dir, ec);
+  return ec ? "" : dir.string();
+#else
+  std::filesystem::path base;
+  const char* xdgCacheHome = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if (xdgCacheHome && xdgCacheHome[0] == '/')
+  {
+    base = xdgCacheHome;
+  }
+  else if (home && home[0] == '/')
+  {
+    base = std::filesystem::path(home) / ".cache";
+  }
+  else
+  {
+    return "";
+  }
+  std::filesystem::create_directories(base, ec);
+
+  auto dir = base / STREAM_CACHE_DIRECTORY;
+  if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST)
+  {
+    return "";
+  }
+  // refuse a directory, or a link, someone else could have put there
+  struct stat st;
+  if (lstat(dir.c_str(), &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077) != 0)
+  {
+    return "";
+  }
+  return dir.string();
+#endif // _WIN32
+}
+
+// the cache directory, preceded by the media file's own directory when besideMedia is set
+static inline std::vector<std::string> sidecarPaths(const std::string& path, const bool& besideMedia)
+{
+  std::vector<std::string> paths;
+  if (besideMedia)
+  {
+    paths.push_back(path + STREAM_CACHE_EXTENSION);
+  }
+
+  auto dir = cacheDirectory();
+  if (!dir.empty())
+  {
+    auto name = std::to_string(std::hash<std::string>{}(path)) + STREAM_CACHE_EXTENSION;
+    paths.push_back((std::filesystem::path(dir) / name).string());
+  }
+  return paths;
+}
+
+// write buffer to a temporary file and rename it over sidecar, so a reader never
+// maps a partial sidecar. the temporary file gets a unique name and is created
+// exclusively, it never follows a link or shares the file of another instance
+static inline bool writeSidecar(const std::string& sidecar, const std::vector<uint8_t>& buffer)
+{
+  std::string tmpPath;
+  bool written = true;
+#ifdef _WIN32
+  static std::atomic_uint tmpCounter = 0;
+  tmpPath = sidecar + "." + std::to_string(GetCurrentProcessId()) + "." + std::to_string(tmpCounter++) + ".tmp";
+  HANDLE file = CreateFileA(tmpPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+  size_t done = 0;
+  while (done < buffer.size())
+  {
+    DWORD size = (DWORD)std::min<size_t>(buffer.size() - done, MAXDWORD);
+    DWORD count = 0;
+    if (!WriteFile(file, buffer.data() + done, size, &count, nullptr) || count == 0)
+    {
+      written = false;
+      break;
+    }
+    done += count;
+  }
+  CloseHandle(file);
+#else
+  std::vector<char> name(sidecar.begin(), sidecar.end());
+  const char suffix[] = ".XXXXXX";
+  name.insert(name.end(), suffix, suffix + sizeof(suffix));
+  int fd = mkstemp(name.data());
+  if (fd < 0)
+  {
+    return false;
+  }
+  tmpPath = name.data();
+  size_t done = 0;
+  while (done < buffer.size())
+  {
+    auto count = write(fd, buffer.data() + done, buffer.size() - done);
+    if (count < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count <= 0)
+    {
+      written = false;
+      break;
+    }
+    done += (size_t)count;
+  }
+  if (close(fd) < 0)
+  {
+    written = false;
+  }
+#endif // _WIN32
+
+  std::error_code ec;
+  if (written)
+  {
+    std::filesystem::rename(tmpPath, sidecar, ec);
+    if (!ec)
+    {
+      return true;
+    }
+  }
+  std::filesystem::remove(tmpPath, ec);
+  return false;
+}
+
+// size and modification time of a regular file, false for anything else (urls)
+static inline bool fileStamp(const std::string& filename, int64_t& fileSize, int64_t& fileTime)
+{
+  std::error_code ec;
+  if (!std::filesystem::is_regular_file(filename, ec))
+  {
+    return false;
+  }
+  auto size = std::filesystem::file_size(filename, ec);
+  if (ec)
+  {
+    return false;
+  }
+  auto time = std::filesystem::last_write_time(filename, ec);
+  if (ec)
+  {
+    return false;
+  }
+  fileSize = (int64_t)size;
+  fileTime = (int64_t)time.time_since_epoch().count();
+  return true;
+}
+
+} // namespace
+
+StreamCache::~StreamCache()
+{
+  this->clear();
+}
+
+void StreamCache::clear()
+{
+  for (auto& stream : m_streams)
+  {
+    avcodec_parameters_free(&stream.codecpar);
+  }
+  m_streams.clear();
+  m_keyframes.clear();
+  m_startTime = AV_NOPTS_VALUE;
+  m_duration = AV_NOPTS_VALUE;
+  m_bitRate = 0;
+  m_keyframeStream = -1;
+  m_indexComplete = false;
+  m_loaded = false;
+}
+
+bool StreamCache::load(const std::string& filename)
+{
+  this->clear();
+
+  int64_t fileSize = 0;
+  int64_t fileTime = 0;
+  if (!fileStamp(filename, fileSize, fileTime))
+  {
+    return false;
+  }
+
+  auto path = absolutePath(filename);
+  for (const auto& sidecar : sidecarPaths(path, m_besideMedia))
+  {
+    MappedFile file(sidecar);
+    if (file.data() && this->parse(file.data(), file.size(), path, fileSize, fileTime))
+    {
+      m_loaded = true;
+      return true;
+    }
+    this->clear();
+  }
+  return false;
+}
+
+bool StreamCache::parse(const uint8_t* data, const size_t& size, const std::string& path,
+  const int64_t& fileSize, const int64_t& fileTime)
+{
+  Cursor cursor(data, size);
+
+  FileHeader header;
+  if (!cursor.read(&header, sizeof(header))
+    || memcmp(header.magic, STREAM_CACHE_MAGIC, sizeof(header.magic)) != 0
+    || header.version != STREAM_CACHE_VERSION)
+  {
+    return false;
+  }
+
+  // the media file was replaced or edited since the sidecar was written
+  if (header.fileSize != fileSize || header.fileTime != fileTime)
+  {
+    return false;
+  }
+
+  if (header.pathSize < 0 || path.size() != (size_t)header.pathSize)
+  {
+    return false;
+  }
+  auto storedPath = cursor.skip((size_t)header.pathSize);
+  if (!storedPath || memcmp(storedPath, path.data(), path.size()) != 0)
+  {
+    return false;
+  }
+
+  if (header.nbStreams <= 0 || header.nbStreams > INT_MAX || header.nbKeyframes < 0)
+  {
+    return false;
+  }
+
+  for (int64_t i = 0; i < header.nbStreams; i++)
+  {
+    StreamRecord record;
+    if (!cursor.read(&record, sizeof(record)) || record.extradataSize < 0 || record.extradataSize > INT_MAX)
+    {
+      return false;
+    }
+
+    CachedStream stream;
+    stream.codecpar = avcodec_parameters_alloc();
+    if (!stream.codecpar)
+    {
+      return false;
+    }
+    // owned from here on, released by clear()
+    m_streams.push_back(stream);
+
+    auto codecpar = stream.codecpar;
+    assign(codecpar->codec_type, record.codecType);
+    assign(codecpar->codec_id, record.codecId);
+    assign(codecpar->codec_tag, record.codecTag);
+    assign(codecpar->format, record.format);
+    assign(codecpar->bit_rate, record.bitRate);
+    assign(codecpar->bits_per_coded_sample, record.bitsPerCodedSample);
+    assign(codecpar->bits_per_raw_sample, record.bitsPerRawSample);
+    assign(codecpar->profile, record.profile);
+    assign(codecpar->level, record.level);
+    assign(codecpar->width, record.width);
+    assign(codecpar->height, record.height);
+    codecpar->sample_aspect_ratio = av_make_q((int)record.sampleAspectNum, (int)record.sampleAspectDen);
+    assign(codecpar->field_order, record.fieldOrder);
+    assign(codecpar->color_range, record.colorRange);
+    assign(codecpar->color_primaries, record.colorPrimaries);
+    assign(codecpar->color_trc, record.colorTrc);
+    assign(codecpar->color_space, record.colorSpace);
+    assign(codecpar->chroma_location, record.chromaLocation);
+    assign(codecpar->video_delay, record.videoDelay);
+    if (record.channelOrder == AV_CHANNEL_ORDER_NATIVE)
+    {
+      av_channel_layout_from_mask(&codecpar->ch_layout, (uint64_t)record.channelMask);
+    }
+    else
+    {
+      codecpar->ch_layout.order = AV_CHANNEL_ORDER_UNSPEC;
+      codecpar->ch_layout.nb_channels = (int)record.nbChannels;
+    }
+    assign(codecpar->sample_rate, record.sampleRate);
+    assign(codecpar->block_align, record.blockAlign);
+    assign(codecpar->frame_size, record.frameSize);
+    assign(codecpar->initial_padding, record.initialPadding);
+    assign(codecpar->trailing_padding, record.trailingPadding);
+    assign(codecpar->seek_preroll, record.seekPreroll);
+
+    if (record.extradataSize > 0)
+    {
+      auto extradata = cursor.skip((size_t)record.extradataSize);
+      if (!extradata)
+      {
+        return false;
+      }
+      // the decoders read past the end, hence the padding
+      codecpar->extradata = (uint8_t*)av_mallocz((size_t)record.extradataSize + AV_INPUT_BUFFER_PADDING_SIZE);
+      if (!codecpar->extradata)
+      {
+        return false;
+      }
+      memcpy(codecpar->extradata, extradata, (size_t)record.extradataSize);
+      codecpar->extradata_size = (int)record.extradataSize;
+    }
+
+    auto& cached = m_streams.back();
+    cached.timeBase = av_make_q((int)record.timeBaseNum, (int)record.timeBaseDen);
+    cached.avgFrameRate = av_make_q((int)record.avgFrameRateNum, (int)record.avgFrameRateDen);
+    cached.realFrameRate = av_make_q((int)record.realFrameRateNum, (int)record.realFrameRateDen);
+    cached.sampleAspectRatio = av_make_q((int)record.streamAspectNum, (int)record.streamAspectDen);
+    cached.startTime = record.startTime;
+    cached.duration = record.duration;
+    cached.nbFrames = record.nbFrames;
+  }
+
+  m_startTime = header.startTime;
+  m_duration = header.duration;
+  m_bitRate = header.bitRate;
+  m_keyframeStream = (int)header.keyframeStream;
+  m_indexComplete = header.indexComplete != 0;
+
+  if (m_indexComplete)
+  {
+    // a corrupt count could wrap the byte size below, check it against what is left
+    if ((uint64_t)header.nbKeyframes > cursor.remaining() / sizeof(KeyframeRecord))
+    {
+      return false;
+    }
+    auto keyframes = cursor.skip((size_t)header.nbKeyframes * sizeof(KeyframeRecord));
+    if (!keyframes)
+    {
+      return false;
+    }
+
+    m_keyframes.resize((size_t)header.nbKeyframes);
+    for (int64_t i = 0; i < header.nbKeyframes; i++)
+    {
+      KeyframeRecord record;
+      memcpy(&record, keyframes + i * sizeof(KeyframeRecord), sizeof(record));
+      m_keyframes[i].pts = record.pts;
+      m_keyframes[i].pos = record.pos;
+    }
+  }
+
+  return true;
+}
+
+bool StreamCache::apply(AVFormatContext* formatCtx) const
+{
+  if (!m_loaded || formatCtx->nb_streams != m_streams.size())
+  {
+    return false;
+  }
+
+  // the demuxer header has to describe the same streams, in the same time bases
+  for (unsigned int i = 0; i < formatCtx->nb_streams; i++)
+  {
+    auto stream = formatCtx->streams[i];
+    const auto& cached = m_streams[i];
+    if (stream->codecpar->codec_type != cached.codecpar->codec_type
+      || stream->codecpar->codec_id != cached.codecpar->codec_id
+      || stream->time_base.num != cached.timeBase.num
+      || stream->time_base.den != cached.timeBase.den)
+    {
+      return false;
+    }
+  }
+
+  for (unsigned int i = 0; i < formatCtx->nb_streams; i++)
+  {
+    auto stream = formatCtx->streams[i];
+    const auto& cached = m_streams[i];
+    if (avcodec_parameters_copy(stream->codecpar, cached.codecpar) < 0)
+    {
+      return false;
+    }
+    stream->avg_frame_rate = cached.avgFrameRate;
+    stream->r_frame_rate = cached.realFrameRate;
+    stream->sample_aspect_ratio = cached.sampleAspectRatio;
+    stream->start_time = cached.startTime;
+    stream->duration = cached.duration;
+    stream->nb_frames = cached.nbFrames;
+  }
+
+  formatCtx->start_time = m_startTime;
+  formatCtx->duration = m_duration;
+  formatCtx->bit_rate = m_bitRate;
+  return true;
+}
+
+int StreamCache::save(const std::string& filename, const AVFormatContext* formatCtx, const int& keyframeStream,
+  const std::vector<KeyframeEntry>& keyframes, const bool& indexComplete)
+{
+  int64_t fileSize = 0;
+  int64_t fileTime = 0;
+  if (!fileStamp(filename, fileSize, fileTime))
+  {
+    return -1;
+  }
+
+  auto path = absolutePath(filename);
+
+  FileHeader header{};
+  memcpy(header.magic, STREAM_CACHE_MAGIC, sizeof(header.magic));
+  header.version = STREAM_CACHE_VERSION;
+  header.fileSize = fileSize;
+  header.fileTime = fileTime;
+  header.pathSize = (int64_t)path.size();
+  header.nbStreams = formatCtx->nb_streams;
+  header.startTime = formatCtx->start_time;
+  header.duration = formatCtx->duration;
+  header.bitRate = formatCtx->bit_rate;
+  header.keyframeStream = keyframeStream;
+  header.indexComplete = indexComplete ? 1 : 0;
+  header.nbKeyframes = indexComplete ? (int64_t)keyframes.size() : 0;
+
+  std::vector<uint8_t> buffer;
+  append(buffer, header);
+  buffer.insert(buffer.end(), path.begin(), path.end());
+
+  for (unsigned int i = 0; i < formatCtx->nb_streams; i++)
+  {
+    auto stream = formatCtx->streams[i];
+    auto codecpar = stream->codecpar;
+
+    StreamRecord record{};
+    record.codecType = codecpar->codec_type;
+    record.codecId = codecpar->codec_id;
+    record.codecTag = codecpar->codec_tag;
+    record.format = codecpar->format;
+    record.bitRate = codecpar->bit_rate;
+    record.bitsPerCodedSample = codecpar->bits_per_coded_sample;
+    record.bitsPerRawSample = codecpar->bits_per_raw_sample;
+    record.profile = codecpar->profile;
+    record.level = codecpar->level;
+    record.width = codecpar->width;
+    record.height = codecpar->height;
+    record.sampleAspectNum = codecpar->sample_aspect_ratio.num;
+    record.sampleAspectDen = codecpar->sample_aspect_ratio.den;
+    record.fieldOrder = codecpar->field_order;
+    record.colorRange = codecpar->color_range;
+    record.colorPrimaries = codecpar->color_primaries;
+    record.colorTrc = codecpar->color_trc;
+    record.colorSpace = codecpar->color_space;
+    record.chromaLocation = codecpar->chroma_location;
+    record.videoDelay = codecpar->video_delay;
+    // custom channel maps are rare, keep their channel count only
+    record.channelOrder = codecpar->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? AV_CHANNEL_ORDER_NATIVE : AV_CHANNEL_ORDER_UNSPEC;
+    record.nbChannels = codecpar->ch_layout.nb_channels;
+    record.channelMask = codecpar->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? (int64_t)codecpar->ch_layout.u.mask : 0;
+    record.sampleRate = codecpar->sample_rate;
+    record.blockAlign = codecpar->block_align;
+    record.frameSize = codecpar->frame_size;
+    record.initialPadding = codecpar->initial_padding;
+    record.trailingPadding = codecpar->trailing_padding;
+    record.seekPreroll = codecpar->seek_preroll;
+    record.timeBaseNum = stream->time_base.num;
+    record.timeBaseDen = stream->time_base.den;
+    record.avgFrameRateNum = stream->avg_frame_rate.num;
+    record.avgFrameRateDen = stream->avg_frame_rate.den;
+    record.realFrameRateNum = stream->r_frame_rate.num;
+    record.realFrameRateDen = stream->r_frame_rate.den;
+    record.streamAspectNum = stream->sample_aspect_ratio.num;
+    record.streamAspectDen = stream->sample_aspect_ratio.den;
+    record.startTime = stream->start_time;
+    record.duration = stream->duration;
+    record.nbFrames = stream->nb_frames;
+    record.extradataSize = codecpar->extradata ? codecpar->extradata_size : 0;
+
+    append(buffer, record);
+    if (record.extradataSize > 0)
+    {
+      buffer.insert(buffer.end(), codecpar->extradata, codecpar->extradata + record.extradataSize);
+    }
+  }
+
+  if (indexComplete)
+  {
+    buffer.reserve(buffer.size() + keyframes.size() * sizeof(KeyframeRecord));
+    for (const auto& entry : keyframes)
+    {
+      KeyframeRecord record;
+      record.pts = entry.pts;
+      record.pos = entry.pos;
+      append(buffer, record);
+    }
+  }
+
+  for (const auto& sidecar : sidecarPaths(path, m_besideMedia))
+  {
+    if (writeSidecar(sidecar, buffer))
+    {
+      return 0;
+    }
+  }
+
+  std::cerr << "stream cache : could not write the sidecar of " << filename << std::endl;
+  return -1;
+}
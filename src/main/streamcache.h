@@ -0,0 +1,83 @@
+
+#ifndef STREAM_CACHE_H_
+#define STREAM_CACHE_H_
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "keyframeindex.h"
+
+namespace player
+{
+
+// bump when the layout of the sidecar file changes, older files are ignored
+#define STREAM_CACHE_VERSION 1
+// appended to the media file name
+#define STREAM_CACHE_EXTENSION ".pidx"
+// sub directory of the per user cache directory holding the sidecars
+#define STREAM_CACHE_DIRECTORY "ffsdlplayer"
+
+// Stream info and key frame table of a local media file, kept in a sidecar file
+// so that reopening it skips avformat_find_stream_info and the key frame scan.
+// The sidecar is keyed by the absolute path, size and modification time of the
+// media file and read through a memory mapping. It lives in the per user cache
+// directory, or next to the media file when besideMedia is set, and is only read
+// back when the current user owns it.
+class StreamCache
+{
+public:
+  explicit StreamCache(const bool& besideMedia = false) : m_besideMedia(besideMedia) {}
+  ~StreamCache();
+
+  // read the sidecar of filename. false when there is none or it is stale
+  bool load(const std::string& filename);
+  // fill the streams opened by avformat_open_input with the cached parameters.
+  // false, leaving formatCtx untouched, when the streams do not match the cache
+  bool apply(AVFormatContext* formatCtx) const;
+  // write the sidecar of filename. keyframes belong to keyframeStream and are
+  // reused on the next open only when indexComplete is set
+  int save(const std::string& filename, const AVFormatContext* formatCtx, const int& keyframeStream,
+    const std::vector<KeyframeEntry>& keyframes, const bool& indexComplete);
+
+  bool isLoaded() const { return m_loaded; }
+  int keyframeStream() const { return m_keyframeStream; }
+  bool isIndexComplete() const { return m_indexComplete; }
+  const std::vector<KeyframeEntry>& keyframes() const { return m_keyframes; }
+
+private:
+  struct CachedStream
+  {
+    AVCodecParameters* codecpar = nullptr;
+    AVRational timeBase{};
+    AVRational avgFrameRate{};
+    AVRational realFrameRate{};
+    AVRational sampleAspectRatio{};
+    int64_t startTime = AV_NOPTS_VALUE;
+    int64_t duration = AV_NOPTS_VALUE;
+    int64_t nbFrames = 0;
+  };
+
+  bool m_besideMedia = false;
+  bool m_loaded = false;
+  std::vector<CachedStream> m_streams;
+  int64_t m_startTime = AV_NOPTS_VALUE;
+  int64_t m_duration = AV_NOPTS_VALUE;
+  int64_t m_bitRate = 0;
+  int m_keyframeStream = -1;
+  bool m_indexComplete = false;
+  std::vector<KeyframeEntry> m_keyframes;
+
+  bool parse(const uint8_t* data, const size_t& size, const std::string& path,
+    const int64_t& fileSize, const int64_t& fileTime);
+  void clear();
+};
+
+} // player
+
+#endif // STREAM_CACHE_H_
@@ -1,11 +1,38 @@
 
 #include <iostream>
 #include <thread>
+#include <cmath>
+#include <algorithm>
 #include "videodecoder.h"
 
 using namespace player;
 
 const int MAX_QUEUE_SIZE = 50;
+// how long the decoder sleeps on an empty packet queue before rechecking its stop flag
+const int PACKET_POP_TIMEOUT_MS = 100;
+
+// skip levels, each one adds to the previous
+// 1 : skip the loop filter
+// 2 : skip non reference frames
+// 3 : skip the idct of non key frames
+const int SKIP_LEVEL_MAX = 3;
+// how often the decoder reviews its skip level (us)
+const int64_t SKIP_CHECK_INTERVAL = 500000;
+// reviews without a late frame needed before stepping one level down
+const int SKIP_CALM_CHECKS = 6;
+// a frame leaving the decoder this far behind the master clock counts as late (s)
+const double SKIP_LATE_THRESHOLD = 0.1;
+
+// whether the frame ends before the target of an exact seek
+static inline bool isBeforeSeekTarget(const AVFrame* frame, const double& pts, const double& timeBase, const double& target)
+{
+  if (frame->duration > 0)
+  {
+    // the frame on screen at the target is the one to start from
+    return pts + frame->duration * timeBase <= target;
+  }
+  return pts < target;
+}
 
 VideoDecoder::~VideoDecoder()
 {
@@ -72,8 +99,9 @@ int VideoDecoder::decodeThread(std::shared_ptr<VideoState> vs)
       }
     }
 
-    // get a packet from videq
-    int ret = videoState->popVideoPacketRead(packet);
+    // get a packet from videq, sleeping until one arrives or the queue is aborted
+    int serial = -1;
+    int ret = videoState->popVideoPacketRead(packet, PACKET_POP_TIMEOUT_MS, &serial);
     if (ret < 0)
     {
       if (videoState->isPlayerFinished())
@@ -84,14 +112,45 @@ int VideoDecoder::decodeThread(std::shared_ptr<VideoState> vs)
       continue;
     }
 
-    auto flushPacket = videoState->flushPacket();
-    if (flushPacket)
+    // the packet was queued before the latest seek, don't bother decoding it
+    if (serial != videoState->videoPacketSerial())
     {
-      if (packet->data == flushPacket->data)
-      {
-        avcodec_flush_buffers(videoCodecCtx);
-        continue;
-      }
+      av_packet_unref(packet);
+      continue;
+    }
+
+    // first packet after a seek, drop the frames buffered in the codec
+    if (serial != m_pktSerial)
+    {
+      avcodec_flush_buffers(videoCodecCtx);
+      m_pktSerial = serial;
+    }
+
+    // escalate or relax frame skipping before the packet reaches the codec
+    this->updateSkipLevel(videoState, videoCodecCtx);
+
+    // fast playback and trick play only show key frames, bound the decoding cost
+    bool keyFrameOnly = videoState->playbackSpeed() > PLAYBACK_SPEED_KEYFRAME_ONLY || videoState->trickPlay() != 0;
+    if (keyFrameOnly != m_keyFrameOnly)
+    {
+      m_keyFrameOnly = keyFrameOnly;
+      this->applySkipLevel(videoCodecCtx);
+    }
+
+    // exact seek : nothing shown before the target refers to a non reference
+    // frame, so the codec may skip those until the packets reach it
+    auto& videoStream = videoState->videoStream();
+    double seekTarget = NAN;
+    if (!m_keyFrameOnly && m_seekDoneSerial != serial)
+    {
+      seekTarget = videoState->videoSeekTarget(serial);
+    }
+    bool seekSkipNonRef = !std::isnan(seekTarget) && packet->pts != AV_NOPTS_VALUE
+      && packet->pts * av_q2d(videoStream->time_base) < seekTarget;
+    if (seekSkipNonRef != m_seekSkipNonRef)
+    {
+      m_seekSkipNonRef = seekSkipNonRef;
+      this->applySkipLevel(videoCodecCtx);
     }
 
     // init set pts to 0 for all frames
@@ -131,14 +190,39 @@ int VideoDecoder::decodeThread(std::shared_ptr<VideoState> vs)
         pts = 0.0;
       }
 
-      auto& videoStream = videoState->videoStream();
       pts *= av_q2d(videoStream->time_base);
 
+      if (!std::isnan(seekTarget))
+      {
+        // decoded only to reach the target, skip the conversion and the queue
+        if (isBeforeSeekTarget(pFrame, pts, av_q2d(videoStream->time_base), seekTarget))
+        {
+          continue;
+        }
+
+        // first frame to show, the rest of this serial plays normally
+        m_seekDoneSerial = serial;
+        seekTarget = NAN;
+        if (m_seekSkipNonRef)
+        {
+          m_seekSkipNonRef = false;
+          this->applySkipLevel(videoCodecCtx);
+        }
+      }
+
       // did we get an entire video frame?
       if (frameFinished)
       {
         pts = this->syncVideo(videoState, pFrame, pts);
-        if (videoState->queuePicture(pFrame, pts) < 0)
+
+        // the renderer would have to drop this frame, remember it for the skip level
+        double diff = pts - videoState->masterClock();
+        if (!std::isnan(diff) && diff < -SKIP_LATE_THRESHOLD)
+        {
+          m_lateFrames++;
+        }
+
+        if (videoState->queuePicture(pFrame, pts, m_pktSerial) < 0)
         {
           break;
         }
@@ -219,3 +303,57 @@ double VideoDecoder::syncVideo(std::shared_ptr<VideoState> videoState, AVFrame*
 
   return pts;
 }
+
+void VideoDecoder::updateSkipLevel(std::shared_ptr<VideoState> videoState, AVCodecContext* ctx)
+{
+  auto now = av_gettime_relative();
+  if (now - m_skipCheckTime < SKIP_CHECK_INTERVAL)
+  {
+    return;
+  }
+  m_skipCheckTime = now;
+
+  // late frames since the last review, dropped by the renderer or seen here
+  auto framesDroppedLate = videoState->framesDroppedLate();
+  auto lateFrames = (int)(framesDroppedLate - m_lastFramesDroppedLate) + m_lateFrames;
+  m_lastFramesDroppedLate = framesDroppedLate;
+  m_lateFrames = 0;
+
+  int skipLevel = m_skipLevel;
+  if (lateFrames > 0)
+  {
+    // falling behind, cheapen decoding one step
+    m_calmChecks = 0;
+    skipLevel = std::min(skipLevel + 1, SKIP_LEVEL_MAX);
+  }
+  else if (skipLevel > 0 && ++m_calmChecks >= SKIP_CALM_CHECKS)
+  {
+    // caught up for a while, give quality back one step
+    m_calmChecks = 0;
+    skipLevel--;
+  }
+
+  if (skipLevel != m_skipLevel)
+  {
+    std::cout << "video decoder skip level : " << m_skipLevel << " -> " << skipLevel
+              << " (" << lateFrames << " late frames)" << std::endl;
+    m_skipLevel = skipLevel;
+    this->applySkipLevel(ctx);
+  }
+}
+
+void VideoDecoder::applySkipLevel(AVCodecContext* ctx)
+{
+  ctx->skip_loop_filter = (m_skipLevel >= 1) ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+  ctx->skip_frame = (m_skipLevel >= 2) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+  if (m_seekSkipNonRef && ctx->skip_frame < AVDISCARD_NONREF)
+  {
+    ctx->skip_frame = AVDISCARD_NONREF;
+  }
+  if (m_keyFrameOnly)
+  {
+    ctx->skip_frame = AVDISCARD_NONKEY;
+  }
+  ctx->skip_idct = (m_skipLevel >= 3) ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+}
+
@@ -12,6 +12,7 @@ extern "C"
 #include <libswresample/swresample.h>
 }
 
+#include <mutex>
 #include "videostate.h"
 
 namespace player
@@ -30,10 +31,27 @@ private:
   std::shared_ptr<VideoState> m_vs = nullptr;
   std::mutex m_mutex;
   bool m_finishedDecoder = false;
+  // serial of the last packet fed to the codec
+  int m_pktSerial = -1;
+
+  // decoder side frame skipping under load
+  int m_skipLevel = 0;
+  int64_t m_skipCheckTime = 0;
+  uint64_t m_lastFramesDroppedLate = 0;
+  int m_lateFrames = 0;
+  int m_calmChecks = 0;
+  // playback is fast enough to decode key frames only
+  bool m_keyFrameOnly = false;
+  // exact seek : serial whose target was reached, and non reference frames
+  // skipped while the packets are still before the target
+  int m_seekDoneSerial = -1;
+  bool m_seekSkipNonRef = false;
 
   int decodeThread(std::shared_ptr<VideoState> vs);
   int64_t guessCorrectPts(AVCodecContext* ctx, const int64_t& reordered_pts, const int64_t& dts);
   double syncVideo(std::shared_ptr<VideoState> vs, AVFrame* srcFrame, double pts);
+  void updateSkipLevel(std::shared_ptr<VideoState> vs, AVCodecContext* ctx);
+  void applySkipLevel(AVCodecContext* ctx);
 };
 
 } // player
@@ -16,11 +16,19 @@ public:
   explicit VideoPicture() = default;
   ~VideoPicture() = default;
 
+  // frame handed to the renderer. it references either the decoder's own
+  // buffers (YUV420P output) or scaledFrame below
   AVFrame *frame = nullptr;
+  // YUV420P conversion target, only allocated when the decoder outputs another format
+  AVFrame *scaledFrame = nullptr;
   int width = 0;
   int height = 0;
   int allocated = 0;
   double pts = 0.0;
+  // video packet queue serial of the packet this picture was decoded from
+  int serial = -1;
+  // av_gettime_relative() when its packet was read, 0 when not tracked
+  int64_t receivedTime = 0;
 };
 
 } // player
@@ -1,7 +1,10 @@
 
 #include <cstring>
+#include <cmath>
+#include <iostream>
 #include <thread>
 #include <utility>
+#include <algorithm>
 
 #include "videostate.h"
 #include "videoreader.h"
@@ -9,10 +12,118 @@
 #include "audiodecoder.h"
 #include "audioresamplingstate.h"
 
-#define MAX_QUEUE_SIZE (15 * 1024 * 1024)
+// pixel rate one decoder thread is expected to sustain (1080p30)
+#define DECODER_PIXELS_PER_THREAD (1920.0 * 1080.0 * 30.0)
+// libavcodec does not scale well past this many threads
+#define DECODER_MAX_THREADS 16
+// longest the read thread sleeps on full queues, notifications normally wake it first
+#define PACKET_READ_WAIT_MS 100
+// backward seeks tried, each going twice as far back, before rewind gives up
+#define TRICK_PLAY_REVERSE_ATTEMPTS 4
 
 using namespace player;
 
+static inline AVSampleFormat sdlToAvSampleFormat(const SDL_AudioFormat& format)
+{
+  switch (format)
+  {
+    case AUDIO_U8:
+      return AV_SAMPLE_FMT_U8;
+    case AUDIO_S16SYS:
+      return AV_SAMPLE_FMT_S16;
+    case AUDIO_S32SYS:
+      return AV_SAMPLE_FMT_S32;
+    case AUDIO_F32SYS:
+      return AV_SAMPLE_FMT_FLT;
+    default:
+      // foreign endianness, swresample cannot write it
+      return AV_SAMPLE_FMT_NONE;
+  }
+}
+
+static inline bool hasCodecParameters(const AVFormatContext* formatCtx)
+{
+  // what the decoders and the audio device need before the first packet
+  bool found = false;
+  for (unsigned int i = 0; i < formatCtx->nb_streams; i++)
+  {
+    auto codecpar = formatCtx->streams[i]->codecpar;
+    if (codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+    {
+      if (codecpar->codec_id == AV_CODEC_ID_NONE || codecpar->width <= 0 || codecpar->height <= 0)
+      {
+        return false;
+      }
+      found = true;
+    }
+    else if (codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+    {
+      if (codecpar->codec_id == AV_CODEC_ID_NONE || codecpar->sample_rate <= 0 || codecpar->ch_layout.nb_channels <= 0)
+      {
+        return false;
+      }
+    }
+  }
+
+  return found;
+}
+
+// seek to an indexed key frame, min and max in the stream time base
+static inline int seekKeyframe(AVFormatContext* formatCtx, const int& streamIndex, const KeyframeEntry& entry, const int64_t& min, const int64_t& max)
+{
+  // containers with discontinuous timestamps (mpeg-ts) have no sample table and
+  // seek by bisecting the file, a byte seek lands right on the key frame instead.
+  // the others seek on the exact key frame pts, which their own index resolves
+  bool byteSeek = entry.pos >= 0 && (formatCtx->iformat->flags & AVFMT_TS_DISCONT)
+    && !(formatCtx->iformat->flags & AVFMT_NO_BYTE_SEEK);
+  return byteSeek
+    ? av_seek_frame(formatCtx, -1, entry.pos, AVSEEK_FLAG_BYTE)
+    : avformat_seek_file(formatCtx, streamIndex, min, entry.pts, max, 0);
+}
+
+// read up to the first key frame packet of the stream
+static inline int readKeyframePacket(AVFormatContext* formatCtx, const int& streamIndex, AVPacket* packet)
+{
+  for (;;)
+  {
+    int ret = av_read_frame(formatCtx, packet);
+    if (ret < 0)
+    {
+      return ret;
+    }
+    if (packet->stream_index == streamIndex && (packet->flags & AV_PKT_FLAG_KEY))
+    {
+      return 0;
+    }
+    av_packet_unref(packet);
+  }
+}
+
+static inline void dumpLatencyStats(const LatencyStats& stats)
+{
+  if (stats.count == 0)
+  {
+    return;
+  }
+
+  std::cout << "display latency : " << stats.count << " pictures"
+            << ", avg " << stats.total / (int64_t)stats.count / 1000.0 << " ms"
+            << ", max " << stats.max / 1000.0 << " ms" << std::endl;
+}
+
+static inline void dumpPacketQueueStats(const char* name, const PacketQueueStats& stats)
+{
+  // packetAllocs stays at the ring capacity when the demux path does not allocate
+  std::cout << name << " packet queue :"
+            << " allocs " << stats.packetAllocs
+            << ", pushed " << stats.pushed
+            << ", popped " << stats.popped
+            << ", discarded " << stats.discarded
+            << ", rejected " << stats.rejected
+            << ", high water " << stats.highWater
+            << std::endl;
+}
+
 int VideoReader::start(const std::string& filename, const int& audioDeviceIndex)
 {
   m_videoState = std::make_unique<VideoState>();
@@ -22,6 +133,14 @@ int VideoReader::start(const std::string& filename, const int& audioDeviceIndex)
   }
 
   m_filename = filename;
+  m_videoState->setVideoPictureQueueCapacity(m_pictureQueueSize);
+  m_videoState->setFrameDrop(m_frameDrop);
+  m_videoState->setSyncType(m_syncType);
+  m_videoState->setPlaybackSpeed(m_playbackSpeed);
+  m_videoState->setLive(m_live, m_liveTargetLatency);
+  m_videoState->setLowLatency(m_lowLatency);
+  m_videoState->setExactSeek(m_exactSeek);
+  m_videoState->setPacketReadLimits(m_maxPacketReadSeconds, m_maxPacketReadSize);
   // set output audio device index
   m_videoState->setOutputAudioDeviceIndex(audioDeviceIndex);
 
@@ -34,8 +153,55 @@ int VideoReader::start(const std::string& filename, const int& audioDeviceIndex)
   return 0;
 }
 
+void VideoReader::setPlaybackSpeed(const double& speed)
+{
+  m_playbackSpeed = std::clamp(speed, PLAYBACK_SPEED_MIN, PLAYBACK_SPEED_MAX);
+  if (m_videoState)
+  {
+    m_videoState->setPlaybackSpeed(m_playbackSpeed);
+  }
+}
+
+double VideoReader::playbackSpeed() const
+{
+  return m_videoState ? m_videoState->playbackSpeed() : m_playbackSpeed;
+}
+
+void VideoReader::setLiveMode(const bool& live, const double& targetLatency)
+{
+  m_live = live;
+  m_liveTargetLatency = targetLatency;
+  if (m_live)
+  {
+    // the source dictates the pace, audio and video both follow the external clock
+    m_syncType = SYNC_TYPE::AV_SYNC_EXTERNAL_MASTER;
+  }
+}
+
+void VideoReader::setLowLatency(const bool& lowLatency)
+{
+  m_lowLatency = lowLatency;
+  if (m_lowLatency)
+  {
+    this->setLiveMode(true, LOW_LATENCY_TARGET_LATENCY);
+    m_pictureQueueSize = LOW_LATENCY_PICTURE_QUEUE_SIZE;
+  }
+}
+
+void VideoReader::setDecoderThreads(const int& threadCount, const DECODE_THREAD_TYPE& threadType)
+{
+  m_decoderThreadCount = threadCount;
+  m_decoderThreadType = threadType;
+}
+
 void VideoReader::stop()
 {
+  if (m_videoState)
+  {
+    // wake up the decoders sleeping on the packet queues
+    m_videoState->abortPacketRead();
+  }
+
   if (m_videoRenderer)
   {
     m_videoRenderer->stop();
@@ -46,8 +212,23 @@ void VideoReader::stop()
     m_videoDecoder->stop();
   }
 
+  if (m_audioDecoder)
+  {
+    m_audioDecoder->stop();
+  }
+
+  if (m_keyframeIndex)
+  {
+    m_keyframeIndex->stop();
+  }
+
   if (m_videoState)
   {
+    dumpPacketQueueStats("video", m_videoState->videoPacketReadStats());
+    dumpPacketQueueStats("audio", m_videoState->audioPacketReadStats());
+    std::cout << "late frames dropped : " << m_videoState->framesDroppedLate() << std::endl;
+    std::cout << "superseded frames dropped : " << m_videoState->framesSuperseded() << std::endl;
+    dumpLatencyStats(m_videoState->displayLatencyStats());
     m_videoState->clearAudioPacketRead();
     m_videoState->clearVideoPacketRead();
   }
@@ -66,6 +247,13 @@ int VideoReader::readThread(std::shared_ptr<VideoState> vs)
   auto& formatCtx = videoState->formatCtx();
   AVDictionary* options = nullptr;
   av_dict_set(&options, "rtsp_transport", "tcp", 0);
+  if (m_lowLatency)
+  {
+    // hand packets over as they arrive and only probe what is needed to start
+    av_dict_set(&options, "fflags", "nobuffer", 0);
+    av_dict_set(&options, "probesize", "32768", 0);
+    av_dict_set(&options, "analyzeduration", "100000", 0);
+  }
   ret = avformat_open_input(&formatCtx, m_filename.c_str(), nullptr, &options);
   if (ret < 0)
   {
@@ -81,12 +269,32 @@ int VideoReader::readThread(std::shared_ptr<VideoState> vs)
   videoStreamIndex = -1;
   audioStreamIndex = -1;
 
-  // read packets of the media file to get stream info
-  ret = avformat_find_stream_info(formatCtx, nullptr);
-  if (ret < 0)
+  // a local file opened before has its stream info in the sidecar cache
+  bool cached = false;
+  if (m_streamCacheEnabled && !m_live)
   {
-    std::cerr << "Could not find stream info " << m_filename << std::endl;
-    return -1;
+    m_streamCache = std::make_unique<StreamCache>(m_streamCacheBesideMedia);
+    cached = m_streamCache->load(m_filename) && m_streamCache->apply(formatCtx);
+  }
+
+  // read packets of the media file to get stream info, unless the cache or the
+  // container header (an sdp for rtsp) already described every stream
+  if (cached)
+  {
+    std::cout << "stream info read from the cache, skipping probing" << std::endl;
+  }
+  else if (m_lowLatency && hasCodecParameters(formatCtx))
+  {
+    std::cout << "stream info already known, skipping probing" << std::endl;
+  }
+  else
+  {
+    ret = avformat_find_stream_info(formatCtx, nullptr);
+    if (ret < 0)
+    {
+      std::cerr << "Could not find stream info " << m_filename << std::endl;
+      return -1;
+    }
   }
 
   // dump info about file onto standard error
@@ -128,6 +336,29 @@ int VideoReader::readThread(std::shared_ptr<VideoState> vs)
   m_videoRenderer = std::make_unique<VideoRenderer>();
   m_videoRenderer->start(videoState);
 
+  // index the key frames of seekable files in the background, or take the
+  // table of the cache when a previous run finished the scan
+  if (!m_live && formatCtx->pb && (formatCtx->pb->seekable & AVIO_SEEKABLE_NORMAL))
+  {
+    m_keyframeIndex = std::make_unique<KeyframeIndex>();
+    if (cached && m_streamCache->isIndexComplete() && m_streamCache->keyframeStream() == videoStreamIndex)
+    {
+      m_keyframeIndex->load(m_streamCache->keyframes());
+      std::cout << "keyframe index : " << m_keyframeIndex->size() << " key frames read from the cache" << std::endl;
+    }
+    else
+    {
+      m_keyframeIndex->start(m_filename, videoStreamIndex, formatCtx->streams[videoStreamIndex]->codecpar);
+    }
+  }
+
+  // save the probed stream info right away, the key frame table follows once scanned
+  bool cacheComplete = cached && m_streamCache->isIndexComplete();
+  if (m_streamCache && !cached)
+  {
+    m_streamCache->save(m_filename, formatCtx, videoStreamIndex, {}, false);
+  }
+
   // return with error in case no audio stream was found
   if (audioStreamIndex == -1)
   {
@@ -160,67 +391,76 @@ int VideoReader::readThread(std::shared_ptr<VideoState> vs)
         break;
       }
     }
+    // enter, leave or turn around fast forward and rewind
+    this->updateTrickPlay(videoState, formatCtx, videoStreamIndex, audioStreamIndex);
+
     // seek stuff goes here
     auto seekReq = videoState->seekRequest();
     if (seekReq)
     {
-      auto seekTargetVideo = videoState->seekPos();
-      auto seekTargetAudio = videoState->seekPos();
-
-      if (videoStreamIndex >= 0 && audioStreamIndex >= 0)
-      {
-        // MSVC does not support compound literals like AV_TIME_BASE_Q in C++ code (compiler error C4576)
-        AVRational timebase{};
-        timebase.num = 1;
-        timebase.den = AV_TIME_BASE;
-
-        seekTargetVideo = av_rescale_q(
-          seekTargetVideo
-          , timebase
-          , formatCtx->streams[videoStreamIndex]->time_base);
-        seekTargetAudio = av_rescale_q(
-          seekTargetAudio
-          , timebase
-          , formatCtx->streams[audioStreamIndex]->time_base);
-      }
-
-      ret = av_seek_frame(
-        formatCtx
-        , videoStreamIndex
-        , seekTargetVideo
-        , videoState->seekFlags());
-      ret &= av_seek_frame(
-        formatCtx
-        , audioStreamIndex
-        , seekTargetAudio
-        , videoState->seekFlags());
+      // only the latest target is served, whatever was requested before it is skipped
+      auto target = videoState->seekTarget();
+      ret = this->seekStream(formatCtx, videoStreamIndex, target);
 
       if (ret >= 0)
       {
+        // start a new serial, the decoders flush and drop everything older
+        int videoSerial = -1;
+        int audioSerial = -1;
         if (videoStreamIndex >= 0)
         {
-          auto& flushPacket = videoState->flushPacket();
-          videoState->clearVideoPacketRead();
-          videoState->pushVideoPacketRead(flushPacket);
+          videoSerial = videoState->flushVideoPacketRead();
         }
 
         if (audioStreamIndex >= 0)
         {
-          auto& flushPacket = videoState->flushPacket();
-          videoState->clearAudioPacketRead();
-          videoState->pushAudioPacketRead(flushPacket);
+          audioSerial = videoState->flushAudioPacketRead();
         }
-        videoState->setSeekRequest(0);
+
+        // the demuxer landed on a key frame, have the decoders catch up to the target
+        if (m_exactSeek)
+        {
+          videoState->setExactSeekTarget((double)target.pos / AV_TIME_BASE, videoSerial, audioSerial);
+        }
+
+        // rewinding goes on from the new position
+        m_trickPos = (double)target.pos / AV_TIME_BASE;
+      }
+      videoState->finishSeek(target);
+
+      if (videoState->seekRequest())
+      {
+        // a newer target came in while seeking, go there before reading anything
+        continue;
       }
     }
 
-    // check audio and video packets queues size
-    if (videoState->sizeAudioPacketRead() + videoState->sizeVideoPacketRead() > MAX_QUEUE_SIZE)
+    if (m_streamCache && !cacheComplete && m_keyframeIndex && m_keyframeIndex->isComplete())
     {
-      // wait for audio and video queues to decrease size
-      SDL_Delay(10);
+      m_streamCache->save(m_filename, formatCtx, videoStreamIndex, m_keyframeIndex->entries(), true);
+      cacheComplete = true;
+    }
+
+    // check the buffered bytes and seconds of the audio and video packet queues,
+    // or the couple of key frames trick play keeps queued
+    if (videoState->hasEnoughPackets())
+    {
+      // wait for the decoders to consume packets, they notify as they pop
+      videoState->waitForPacketReadSpace(PACKET_READ_WAIT_MS);
+      continue;
+    }
+
+    if (m_trickRate < 0)
+    {
+      // one seek per key frame shown, back to normal playback when rewinding
+      // cannot go on. readPreviousKeyframe says why
+      if (this->readPreviousKeyframe(videoState, formatCtx, videoStreamIndex, packet) < 0)
+      {
+        videoState->setTrickPlay(0);
+      }
       continue;
     }
+
     // read data from the AVFormatContext by repeatedly calling av_read_frame
     ret = av_read_frame(formatCtx, packet);
     if (ret < 0)
@@ -249,14 +489,32 @@ int VideoReader::readThread(std::shared_ptr<VideoState> vs)
       }
     }
 
+    // fast forward only decodes key frames, for demuxers that ignore the stream discard
+    if (m_trickRate != 0 && (packet->stream_index != videoStreamIndex || !(packet->flags & AV_PKT_FLAG_KEY)))
+    {
+      av_packet_unref(packet);
+      continue;
+    }
+
     // put the packet in the appropriate queue
     if (packet->stream_index == videoStreamIndex)
     {
-      videoState->pushVideoPacketRead(packet);
+      if (m_lowLatency)
+      {
+        // the decoder copies this to the frame, the renderer measures from it
+        packet->opaque = (void*)(intptr_t)av_gettime_relative();
+      }
+      if (videoState->pushVideoPacketRead(packet) < 0)
+      {
+        av_packet_unref(packet);
+      }
     }
     else if (packet->stream_index == audioStreamIndex)
     {
-      videoState->pushAudioPacketRead(packet);
+      if (videoState->pushAudioPacketRead(packet) < 0)
+      {
+        av_packet_unref(packet);
+      }
     }
     else
     {
@@ -297,12 +555,6 @@ int VideoReader::streamComponentOpen(std::shared_ptr<VideoState> vs, const int&
   // retrieve codec context
   AVCodecContext* codecCtx = avcodec_alloc_context3(codec);
 
-  // use multi core
-  // fhd, 60p = 1 threads
-  // 4k, 60p  = 4 threads
-  //codecCtx->thread_count = 4;
-  //codecCtx->thread_type = FF_THREAD_FRAME;
-
   int ret = avcodec_parameters_to_context(codecCtx, formatCtx->streams[streamIndex]->codecpar);
   if (ret != 0)
   {
@@ -310,6 +562,21 @@ int VideoReader::streamComponentOpen(std::shared_ptr<VideoState> vs, const int&
     return -1;
   }
 
+  // use multi core for video, the size of the frame is known from here
+  if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+  {
+    this->setupDecoderThreads(codecCtx, formatCtx->streams[streamIndex]);
+
+    if (m_lowLatency)
+    {
+      // output each frame as soon as it is complete, keep the packet read time on it
+      codecCtx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+#ifdef AV_CODEC_FLAG_COPY_OPAQUE
+      codecCtx->flags |= AV_CODEC_FLAG_COPY_OPAQUE;
+#endif
+    }
+  }
+
   // init the AVCodecContext to use the given AVCodec
   if (avcodec_open2(codecCtx, codec, nullptr) < 0)
   {
@@ -317,6 +584,25 @@ int VideoReader::streamComponentOpen(std::shared_ptr<VideoState> vs, const int&
     return -1;
   }
 
+  if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO)
+  {
+    // log what libavcodec actually enabled
+    const char* activeThreadType = "none";
+    if (codecCtx->active_thread_type & FF_THREAD_FRAME)
+    {
+      activeThreadType = "frame";
+    }
+    else if (codecCtx->active_thread_type & FF_THREAD_SLICE)
+    {
+      activeThreadType = "slice";
+    }
+    std::cout << "video decoder : " << codec->name
+              << " " << codecCtx->width << "x" << codecCtx->height
+              << ", threads " << codecCtx->thread_count
+              << " (" << activeThreadType << ")"
+              << std::endl;
+  }
+
   switch (codecCtx->codec_type)
   {
     case AVMEDIA_TYPE_AUDIO:
@@ -325,11 +611,14 @@ int VideoReader::streamComponentOpen(std::shared_ptr<VideoState> vs, const int&
       audioCodecCtx = std::move(codecCtx);
       auto& audioStream = vs->audioStream();
       audioStream = formatCtx->streams[streamIndex];
+      vs->setAudioPacketReadTimeBase(audioStream->time_base);
 
+      // ask for float samples at the codec rate, but take whatever the device
+      // prefers so that SDL does not convert a second time behind our back
       SDL_AudioSpec wants{};
       SDL_AudioSpec spec{};
       wants.freq = audioCodecCtx->sample_rate;
-      wants.format = AUDIO_S16SYS;
+      wants.format = AUDIO_F32SYS;
       wants.channels = audioCodecCtx->ch_layout.nb_channels;
       wants.silence = 0;
       wants.samples = SDL_AUDIO_BUFFER_SIZE;
@@ -338,15 +627,59 @@ int VideoReader::streamComponentOpen(std::shared_ptr<VideoState> vs, const int&
 
       // open audio device
       auto outputAudioDeviceIndex = vs->outputAudioDeviceIndex();
-      auto sdlAudioDeviceID = vs->sdlAudioDeviceID();
-      sdlAudioDeviceID = SDL_OpenAudioDevice(SDL_GetAudioDeviceName(outputAudioDeviceIndex, 0), false, &wants, &spec, 0);
+      auto deviceName = SDL_GetAudioDeviceName(outputAudioDeviceIndex, 0);
+      auto allowedChanges = SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_FORMAT_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE;
+      auto sdlAudioDeviceID = SDL_OpenAudioDevice(deviceName, false, &wants, &spec, allowedChanges);
+      if (sdlAudioDeviceID > 0 && sdlToAvSampleFormat(spec.format) == AV_SAMPLE_FMT_NONE)
+      {
+        // the native format is not one we can produce, let SDL convert from s16
+        SDL_CloseAudioDevice(sdlAudioDeviceID);
+        wants.format = AUDIO_S16SYS;
+        allowedChanges &= ~SDL_AUDIO_ALLOW_FORMAT_CHANGE;
+        sdlAudioDeviceID = SDL_OpenAudioDevice(deviceName, false, &wants, &spec, allowedChanges);
+      }
       if (sdlAudioDeviceID <= 0)
       {
+        std::cerr << "SDL_OpenAudioDevice: " << SDL_GetError() << std::endl;
         ret = -1;
         return -1;
       }
+
+      // resample straight to what the device was opened with
+      AudioParams audioTgt;
+      audioTgt.freq = spec.freq;
+      audioTgt.channels = spec.channels;
+      audioTgt.fmt = sdlToAvSampleFormat(spec.format);
+      audioTgt.frameSize = av_samples_get_buffer_size(nullptr, audioTgt.channels, 1, audioTgt.fmt, 1);
+      audioTgt.bytesPerSec = av_samples_get_buffer_size(nullptr, audioTgt.channels, audioTgt.freq, audioTgt.fmt, 1);
+      audioTgt.silence = spec.silence;
+      if (audioTgt.frameSize <= 0 || audioTgt.bytesPerSec <= 0)
+      {
+        std::cerr << "av_samples_get_buffer_size error." << std::endl;
+        SDL_CloseAudioDevice(sdlAudioDeviceID);
+        return -1;
+      }
+      vs->setAudioTgt(audioTgt);
+
+      vs->setAudioHwBufSize(spec.size);
+
+      // drift below one device buffer is not worth correcting
+      vs->setAudioDiffThreshold((double)spec.size / audioTgt.bytesPerSec);
+
+      std::cout << "audio device : " << audioTgt.freq << " Hz"
+                << ", " << audioTgt.channels << " channels"
+                << ", " << av_get_sample_fmt_name(audioTgt.fmt)
+                << ", " << spec.samples << " samples" << std::endl;
+
       vs->setSdlAudioDeviceID(sdlAudioDeviceID);
 
+      // start audio thread, the callback only drains its ring buffer
+      m_audioDecoder = std::make_unique<AudioDecoder>();
+      if (m_audioDecoder->start(vs) < 0)
+      {
+        return -1;
+      }
+
       // start playing audio device
       SDL_PauseAudioDevice(sdlAudioDeviceID, 0);
     }
@@ -358,33 +691,247 @@ int VideoReader::streamComponentOpen(std::shared_ptr<VideoState> vs, const int&
       // previous frame delay: 1ms = 1e-6s
       vs->setFrameDecodeTimer((double)av_gettime() / 1000000.0);
       vs->setFrameDecodeLastDelay(40e-3);
-      vs->setVideoDecodeCurrentPtsTime(av_gettime());
 
       auto& videoCodecCtx = vs->videoCodecCtx();
       videoCodecCtx = std::move(codecCtx);
       auto& videoStream = vs->videoStream();
       videoStream = formatCtx->streams[streamIndex];
+      vs->setVideoPacketReadTimeBase(videoStream->time_base);
 
       // start video thread
       m_videoDecoder = std::make_unique<VideoDecoder>();
       m_videoDecoder->start(vs);
-
-      // set up the videostate swscontext to convert the image data to yuv420
-      auto& decodeVideoSwsCtx = vs->decodeVideoSwsCtx();
-      decodeVideoSwsCtx = sws_getContext(
-        videoCodecCtx->width
-        , videoCodecCtx->height
-        , videoCodecCtx->pix_fmt
-        , videoCodecCtx->width
-        , videoCodecCtx->height
-        , AV_PIX_FMT_YUV420P
-        , SWS_BILINEAR
-        , nullptr
-        , nullptr
-        , nullptr);
     }
     break;
   }
   return 0;
 }
 
+int VideoReader::seekStream(AVFormatContext* formatCtx, const int& streamIndex, const SeekTarget& target)
+{
+  // MSVC does not support compound literals like AV_TIME_BASE_Q in C++ code (compiler error C4576)
+  AVRational timebase{};
+  timebase.num = 1;
+  timebase.den = AV_TIME_BASE;
+  auto streamTimebase = formatCtx->streams[streamIndex]->time_base;
+  auto streamTarget = av_rescale_q(target.pos, timebase, streamTimebase);
+  auto streamMin = target.min == INT64_MIN ? INT64_MIN : av_rescale_q(target.min, timebase, streamTimebase);
+  auto streamMax = target.max == INT64_MAX ? INT64_MAX : av_rescale_q(target.max, timebase, streamTimebase);
+
+  // jump straight to the key frame of the gop holding the target, or to the next
+  // one when that gop starts before the bounds of the jump
+  KeyframeEntry entry;
+  bool found = false;
+  if (m_keyframeIndex)
+  {
+    found = m_keyframeIndex->find(streamTarget, entry) && entry.pts >= streamMin;
+    if (!found)
+    {
+      found = m_keyframeIndex->findNext(streamTarget - 1, entry) && entry.pts <= streamMax;
+    }
+  }
+
+  if (found && seekKeyframe(formatCtx, streamIndex, entry, streamMin, streamMax) >= 0)
+  {
+    return 0;
+  }
+
+  // not indexed yet, let the demuxer pick the key frame closest to the target
+  // within the bounds. one seek moves the read position of every stream
+  int ret = avformat_seek_file(formatCtx, -1, target.min, target.pos, target.max, 0);
+  if (ret < 0)
+  {
+    std::cerr << "Error while seeking " << m_filename << std::endl;
+  }
+  return ret;
+}
+
+void VideoReader::updateTrickPlay(std::shared_ptr<VideoState> vs, AVFormatContext* formatCtx, const int& videoStreamIndex, const int& audioStreamIndex)
+{
+  auto rate = vs->trickPlay();
+  if (rate == m_trickRate)
+  {
+    return;
+  }
+  // rewinding seeks back for every picture
+  if (rate < 0 && !(formatCtx->pb && (formatCtx->pb->seekable & AVIO_SEEKABLE_NORMAL)))
+  {
+    std::cout << "rewind : the input is not seekable" << std::endl;
+    vs->setTrickPlay(m_trickRate);
+    return;
+  }
+
+  auto previousRate = m_trickRate;
+  m_trickRate = rate;
+  auto position = vs->displayedPts();
+
+  // let the demuxer skip what trick play does not show : audio and inter frames
+  if (audioStreamIndex >= 0)
+  {
+    formatCtx->streams[audioStreamIndex]->discard = (rate != 0) ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+  }
+  formatCtx->streams[videoStreamIndex]->discard = (rate != 0) ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+
+  if (rate == 0)
+  {
+    // audio and video start over together from the picture on screen
+    vs->streamSeek((int64_t)(position * AV_TIME_BASE), 0);
+    std::cout << "trick play : off" << std::endl;
+    return;
+  }
+
+  std::cout << "trick play : " << rate << "x" << std::endl;
+
+  // mute right away, the queued audio would play at the wrong time
+  if (previousRate == 0 && audioStreamIndex >= 0)
+  {
+    vs->flushAudioPacketRead();
+  }
+
+  if (rate < 0 && previousRate >= 0)
+  {
+    // what was read ahead is on the wrong side now
+    vs->flushVideoPacketRead();
+    m_trickPos = position;
+  }
+  else if (rate > 0 && previousRate < 0)
+  {
+    // the read position is wherever the last backward seek left it
+    vs->streamSeek((int64_t)(position * AV_TIME_BASE), 0);
+  }
+}
+
+int VideoReader::readPreviousKeyframe(std::shared_ptr<VideoState> vs, AVFormatContext* formatCtx, const int& streamIndex, AVPacket* packet)
+{
+  auto stream = formatCtx->streams[streamIndex];
+  auto timeBase = av_q2d(stream->time_base);
+  auto startPos = (stream->start_time != AV_NOPTS_VALUE) ? stream->start_time * timeBase : 0.0;
+  if (m_trickPos <= startPos)
+  {
+    std::cout << "rewind : reached the start" << std::endl;
+    return -1;
+  }
+
+  // jump back what the rate covers in one frame interval
+  double step = -vs->trickPlay() * TRICK_PLAY_FRAME_INTERVAL;
+  auto streamPos = (int64_t)(m_trickPos / timeBase);
+  auto streamTarget = (int64_t)(std::max(m_trickPos - step, startPos) / timeBase);
+
+  // the index knows the key frame at or before the target, or at least the one
+  // right before the picture on screen when the target is ahead of the first entry
+  KeyframeEntry entry;
+  bool indexed = m_keyframeIndex && (m_keyframeIndex->find(streamTarget, entry)
+    || (m_keyframeIndex->find(streamPos, entry) && m_keyframeIndex->findPrevious(streamPos, entry)));
+  if (indexed && entry.pts < streamPos
+    && seekKeyframe(formatCtx, streamIndex, entry, INT64_MIN, streamPos - 1) >= 0
+    && readKeyframePacket(formatCtx, streamIndex, packet) >= 0)
+  {
+    auto pts = (packet->pts != AV_NOPTS_VALUE) ? packet->pts : packet->dts;
+    if (pts != AV_NOPTS_VALUE && pts < streamPos)
+    {
+      m_trickPos = pts * timeBase;
+      if (vs->pushVideoPacketRead(packet) < 0)
+      {
+        av_packet_unref(packet);
+      }
+      return 0;
+    }
+    av_packet_unref(packet);
+  }
+
+  // not indexed yet : seek back blindly, further each time the demuxer lands
+  // on the key frame already shown
+  bool fromStart = false;
+  for (int attempt = 0; attempt < TRICK_PLAY_REVERSE_ATTEMPTS && !fromStart; attempt++, step *= 2)
+  {
+    fromStart = m_trickPos - step <= startPos;
+
+    SeekTarget target;
+    target.pos = (int64_t)(std::max(m_trickPos - step, startPos) * AV_TIME_BASE);
+    target.max = (int64_t)(m_trickPos * AV_TIME_BASE) - 1;
+    if (this->seekStream(formatCtx, streamIndex, target) < 0)
+    {
+      std::cout << "rewind : the input cannot seek back" << std::endl;
+      return -1;
+    }
+
+    int ret = readKeyframePacket(formatCtx, streamIndex, packet);
+    if (ret < 0)
+    {
+      std::cout << "rewind : no key frame after the backward seek" << std::endl;
+      return -1;
+    }
+
+    auto pts = (packet->pts != AV_NOPTS_VALUE) ? packet->pts : packet->dts;
+    if (pts != AV_NOPTS_VALUE && pts * timeBase < m_trickPos)
+    {
+      m_trickPos = pts * timeBase;
+      if (vs->pushVideoPacketRead(packet) < 0)
+      {
+        av_packet_unref(packet);
+      }
+      return 0;
+    }
+    av_packet_unref(packet);
+  }
+
+  if (fromStart)
+  {
+    // even a seek to the start lands on the picture shown, nothing is before it
+    std::cout << "rewind : reached the start" << std::endl;
+  }
+  else
+  {
+    std::cout << "rewind : no key frame within " << step / 2 << " s before "
+              << m_trickPos << " s, the demuxer keeps landing after it" << std::endl;
+  }
+  return -1;
+}
+
+void VideoReader::setupDecoderThreads(AVCodecContext* codecCtx, AVStream* stream)
+{
+  int threadCount = m_decoderThreadCount;
+  if (threadCount <= 0)
+  {
+    int cores = (int)std::thread::hardware_concurrency();
+    if (cores <= 0)
+    {
+      cores = 1;
+    }
+
+    // fall back to 30 fps when the container does not tell
+    auto frameRate = av_guess_frame_rate(m_videoState->formatCtx(), stream, nullptr);
+    double fps = (frameRate.num > 0 && frameRate.den > 0) ? av_q2d(frameRate) : 30.0;
+
+    // fhd, 30p = 2 threads
+    // 4k, 60p  = 9 threads (bounded by the number of cores)
+    double load = (double)codecCtx->width * codecCtx->height * fps / DECODER_PIXELS_PER_THREAD;
+    threadCount = (load <= 0.5) ? 1 : (int)std::ceil(load) + 1;
+    threadCount = std::clamp(threadCount, 1, std::min(cores, DECODER_MAX_THREADS));
+  }
+  codecCtx->thread_count = threadCount;
+
+  switch (m_decoderThreadType)
+  {
+    case DECODE_THREAD_TYPE::FRAME:
+    {
+      codecCtx->thread_type = FF_THREAD_FRAME;
+    }
+    break;
+
+    case DECODE_THREAD_TYPE::SLICE:
+    {
+      codecCtx->thread_type = FF_THREAD_SLICE;
+    }
+    break;
+
+    case DECODE_THREAD_TYPE::AUTO:
+    default:
+    {
+      // frame threading delays every picture by the number of threads
+      codecCtx->thread_type = m_lowLatency ? FF_THREAD_SLICE : (FF_THREAD_FRAME | FF_THREAD_SLICE);
+    }
+    break;
+  }
+}
+
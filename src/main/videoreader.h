@@ -22,10 +22,23 @@ extern "C"
 
 #include "videorenderer.h"
 #include "videodecoder.h"
+#include "audiodecoder.h"
+#include "keyframeindex.h"
+#include "streamcache.h"
 
 namespace player
 {
 
+enum class DECODE_THREAD_TYPE
+{
+  // let libavcodec pick frame threading, or slice threading when frames are not supported
+  AUTO,
+  // one frame per thread : best throughput, adds thread_count frames of latency
+  FRAME,
+  // slices of one frame per thread : no extra latency, needs a sliced bitstream
+  SLICE,
+};
+
 class VideoState;
 
 class VideoReader
@@ -37,14 +50,66 @@ public:
   int start(const std::string& filename, const int& audioDeviceIndex);
   void stop();
   bool isFinished() const { return m_isFinished; }
+  // threadCount 0 sizes the video decoder thread pool from resolution, frame rate and cores
+  void setDecoderThreads(const int& threadCount, const DECODE_THREAD_TYPE& threadType);
+  // number of decoded pictures buffered ahead of the renderer
+  void setPictureQueueSize(const int& size) { m_pictureQueueSize = size; }
+  // drop late pictures in the renderer to catch up with the master clock
+  void setFrameDrop(const bool& frameDrop) { m_frameDrop = frameDrop; }
+  // clock the other streams follow
+  void setSyncType(const SYNC_TYPE& syncType) { m_syncType = syncType; }
+  // playback rate, 0.5x to 4x. audio keeps its pitch, video above 2x shows key frames only
+  void setPlaybackSpeed(const double& speed);
+  double playbackSpeed() const;
+  // live network input : sync to the external clock and steer its speed to keep
+  // targetLatency seconds buffered
+  void setLiveMode(const bool& live, const double& targetLatency = LIVE_TARGET_LATENCY);
+  // camera feeds : no input buffering, minimal probing, slice threading, a
+  // shallow picture queue showing only the newest frame and latency statistics
+  void setLowLatency(const bool& lowLatency);
+  // after a seek, decode from the key frame and start playing at the exact target
+  void setExactSeek(const bool& exactSeek) { m_exactSeek = exactSeek; }
+  // packets the read thread buffers ahead of each decoder, in seconds and bytes
+  void setPacketReadLimits(const double& maxSeconds, const int64_t& maxBytes) { m_maxPacketReadSeconds = maxSeconds; m_maxPacketReadSize = maxBytes; }
+  // keep the stream info and key frame table of local files in a sidecar file
+  void setStreamCache(const bool& enabled) { m_streamCacheEnabled = enabled; }
+  // write the sidecar next to the media file instead of the user cache directory
+  void setStreamCacheBesideMedia(const bool& besideMedia) { m_streamCacheBesideMedia = besideMedia; }
 
 private:
   std::shared_ptr<VideoState> m_videoState = nullptr;
   std::unique_ptr<VideoDecoder> m_videoDecoder = nullptr;
+  std::unique_ptr<AudioDecoder> m_audioDecoder = nullptr;
   std::unique_ptr<VideoRenderer> m_videoRenderer = nullptr;
+  std::unique_ptr<KeyframeIndex> m_keyframeIndex = nullptr;
+  std::unique_ptr<StreamCache> m_streamCache = nullptr;
   std::string m_filename = "";
   std::atomic_bool m_isFinished = false;
+  int m_decoderThreadCount = 0;
+  DECODE_THREAD_TYPE m_decoderThreadType = DECODE_THREAD_TYPE::AUTO;
+  int m_pictureQueueSize = VIDEO_PICTURE_QUEUE_SIZE;
+  bool m_frameDrop = true;
+  SYNC_TYPE m_syncType = SYNC_TYPE::AV_SYNC_AUDIO_MASTER;
+  double m_playbackSpeed = 1.0;
+  bool m_live = false;
+  double m_liveTargetLatency = LIVE_TARGET_LATENCY;
+  bool m_lowLatency = false;
+  bool m_streamCacheEnabled = true;
+  bool m_streamCacheBesideMedia = false;
+  bool m_exactSeek = false;
+  double m_maxPacketReadSeconds = MAX_STREAM_PACKET_READ_DURATION;
+  int64_t m_maxPacketReadSize = MAX_STREAM_PACKET_READ_SIZE;
+  // trick play rate the read thread applied, and the position rewinding went back to (s)
+  int m_trickRate = 0;
+  double m_trickPos = 0.0;
 
+  void setupDecoderThreads(AVCodecContext* codecCtx, AVStream* stream);
+  // seek to target, through the key frame index when it covers it
+  int seekStream(AVFormatContext* formatCtx, const int& streamIndex, const SeekTarget& target);
+  // apply a trick play rate change : stream discards, muting and repositioning
+  void updateTrickPlay(std::shared_ptr<VideoState> vs, AVFormatContext* formatCtx, const int& videoStreamIndex, const int& audioStreamIndex);
+  // rewind : queue the key frame before m_trickPos, -1 at the start of the file
+  int readPreviousKeyframe(std::shared_ptr<VideoState> vs, AVFormatContext* formatCtx, const int& streamIndex, AVPacket* packet);
   int streamComponentOpen(std::shared_ptr<VideoState> vs, const int& streamIndex);
   int readThread(std::shared_ptr<VideoState> vs);
 };
@@ -4,6 +4,8 @@
 #endif
 #include <iostream>
 #include <thread>
+#include <cmath>
+#include <algorithm>
 #include "videorenderer.h"
 
 #define FF_REFRESH_EVENT (SDL_USEREVENT)
@@ -14,6 +16,11 @@
 
 // no av sync correction is done if the clock difference is below the minimum av sync shreshold
 #define AV_NOSYNC_THRESHOLD 1.0
+// largest pts gap accepted between two pictures in key frame only playback
+#define MAX_KEYFRAME_INTERVAL 10.0
+
+// rates the [ and ] keys step through
+static const double PLAYBACK_SPEED_STEPS[] = {0.5, 0.75, 1.0, 1.25, 1.5, 2.0, 3.0, 4.0};
 
 using namespace player;
 
@@ -98,13 +105,60 @@ int VideoRenderer::displayThread()
           }
           break;
 
+          case SDLK_LEFTBRACKET:
+          {
+            this->stepPlaybackSpeed(-1);
+          }
+          break;
+
+          case SDLK_RIGHTBRACKET:
+          {
+            this->stepPlaybackSpeed(1);
+          }
+          break;
+
+          // j k l : rewind, normal playback, fast forward
+          case SDLK_j:
+          {
+            this->stepTrickPlay(-1);
+          }
+          break;
+
+          case SDLK_k:
+          {
+            this->stepTrickPlay(0);
+          }
+          break;
+
+          case SDLK_l:
+          {
+            this->stepTrickPlay(1);
+          }
+          break;
+
+          case SDLK_BACKSPACE:
+          {
+            if (m_vs)
+            {
+              m_vs->setPlaybackSpeed(1.0);
+              std::cout << "playback speed : 1x" << std::endl;
+            }
+          }
+          break;
+
           do_seek:
           {
             if (m_vs)
             {
               pos = m_vs->masterClock();
+              if (m_vs->seekRequest() || std::isnan(pos))
+              {
+                // a seek is still pending, or the clock is not valid yet after
+                // the previous one : jump from its target so held keys add up
+                pos = (double)m_vs->seekPos() / AV_TIME_BASE;
+              }
               pos += incr;
-              m_vs->streamSeek((int64_t)(pos * AV_TIME_BASE), incr);
+              m_vs->streamSeek((int64_t)(pos * AV_TIME_BASE), (int64_t)(incr * AV_TIME_BASE));
             }
             break;
           }
@@ -175,94 +229,211 @@ void VideoRenderer::videoRefreshTimer()
 
   // check the video stream was correctly opened
   auto& videoStream = m_vs->videoStream();
-  if (videoStream)
+  if (!videoStream)
+  {
+    this->scheduleRefresh(100);
+    return;
+  }
+
+  for (;;)
   {
     // check the videopicture queue contains decoded frames
     auto pictureQueueSize = m_vs->videoPictureQueueSize();
     if (pictureQueueSize == 0)
     {
       this->scheduleRefresh(1);
+      return;
     }
-    else
+
+    // Get videopicture reference using the queue read index
+    auto& videoPicture = m_vs->videoPicture();
+
+    // the picture was decoded before the latest seek, drop it without showing it
+    if (videoPicture.serial != m_vs->videoPacketSerial())
     {
-      // Get videopicture reference using the queue read index
-      auto& videoPicture = m_vs->videoPicture();
+      m_vs->popVideoPicture();
+      continue;
+    }
 
-      // get last frame pts
-      auto frameDecodeLastPts = m_vs->frameDecodeLastPts();
-      pts_delay = videoPicture.pts - frameDecodeLastPts;
+    // first picture after a seek, restart the frame timer from now
+    if (videoPicture.serial != m_lastSerial)
+    {
+      m_vs->setFrameDecodeTimer(av_gettime() / 1000000.0);
+      m_vs->setFrameDecodeLastPts(videoPicture.pts);
+      m_lastSerial = videoPicture.serial;
+
+      // the external clock starts over from the stream position
+      m_vs->setExternalClock(videoPicture.pts, videoPicture.serial);
+    }
 
-      // if the obtained delay is incorrect
-      if (pts_delay <= 0 || pts_delay >= 1.0)
+    // live sources steer the external clock toward the buffer target, low latency included
+    if (m_vs->syncType() == SYNC_TYPE::AV_SYNC_EXTERNAL_MASTER)
+    {
+      // a stalled or restarted source leaves the external clock far away, follow the video again
+      if (fabs(m_vs->calcExternalClock() - videoPicture.pts) > AV_NOSYNC_THRESHOLD)
       {
-        // use the previously calculated delay
-        pts_delay = frameDecodeLastPts;
+        m_vs->setExternalClock(videoPicture.pts, videoPicture.serial);
       }
+      m_vs->updateExternalClockSpeed();
+    }
 
-      // save delay information for the next time
-      m_vs->setFrameDecodeLastDelay(pts_delay);
-      m_vs->setFrameDecodeLastPts(videoPicture.pts);
+    if (m_vs->isLowLatency())
+    {
+      // anything but the newest picture is already stale for a camera feed
+      if (pictureQueueSize > 1)
+      {
+        m_vs->addFrameSuperseded();
+        m_vs->popVideoPicture();
+        continue;
+      }
 
-      // update delay to stay in sync with the audio
-      audio_ref_clock = this->getAudioClock();
-      audio_video_delay = videoPicture.pts - audio_ref_clock;
+      m_vs->setVideoDisplayClock(videoPicture.pts, videoPicture.serial);
+      this->videoDisplay();
 
-      // skip or repeat the frame taking into account the delay
-      sync_threshold = (pts_delay > AV_SYNC_THRESHOLD) ? pts_delay : AV_SYNC_THRESHOLD;
+      // time from reading the packet to putting its picture on screen
+      if (videoPicture.receivedTime > 0)
+      {
+        m_vs->addDisplayLatency(av_gettime_relative() - videoPicture.receivedTime);
+      }
 
-      // check audio video delay absolute value is below sync threshold
-      if (fabs(audio_video_delay) < AV_NOSYNC_THRESHOLD)
+      m_vs->popVideoPicture();
+      this->scheduleRefresh(1);
+      return;
+    }
+
+    auto trickRate = m_vs->trickPlay();
+    if (trickRate != 0)
+    {
+      // key frames only and audio muted : no clock to follow, pace the pictures
+      // by the wall clock, at rate times their pts distance in either direction
+      // the first picture after a seek has no distance and goes up right away
+      auto delay = fabs(videoPicture.pts - m_vs->frameDecodeLastPts()) / abs(trickRate);
+      if (delay >= MAX_KEYFRAME_INTERVAL)
       {
-        if (audio_video_delay <= -sync_threshold)
-        {
-          pts_delay = 0;
-        }
-        else if (audio_video_delay >= sync_threshold)
-        {
-          pts_delay = 2 * pts_delay;
-        }
+        delay = m_vs->frameDecodeLastDelay();
       }
+      else if (delay > 0)
+      {
+        m_vs->setFrameDecodeLastDelay(delay);
+      }
+      m_vs->setFrameDecodeLastPts(videoPicture.pts);
 
-      auto frameDecodeTimer = m_vs->frameDecodeTimer() + pts_delay;
-      m_vs->setFrameDecodeTimer(frameDecodeTimer);
-      // compute the real delay
-      real_delay = frameDecodeTimer - (av_gettime() / 1000000.0);
-      if (real_delay < 0.010)
+      auto frameDecodeTimer = m_vs->frameDecodeTimer() + delay;
+      auto now = av_gettime() / 1000000.0;
+      if (now > frameDecodeTimer + delay && pictureQueueSize > 1)
+      {
+        // decoding fell behind, skip ahead rather than slowing the trick rate down
+        m_vs->setFrameDecodeTimer(frameDecodeTimer);
+        m_vs->popVideoPicture();
+        continue;
+      }
+      if (now > frameDecodeTimer + delay)
       {
-        real_delay = 0.010;
+        // nothing newer to show, restart the schedule from this picture
+        frameDecodeTimer = now;
       }
+      m_vs->setFrameDecodeTimer(frameDecodeTimer);
 
+      real_delay = std::max(frameDecodeTimer - now, 0.010);
       this->scheduleRefresh((int)(real_delay * 1000 + 0.5));
 
-      // show the frame on the sdl_surface
+      m_vs->setVideoDisplayClock(videoPicture.pts, videoPicture.serial);
       this->videoDisplay();
+      m_vs->popVideoPicture();
+      return;
+    }
+
+    // get last frame pts
+    auto frameDecodeLastPts = m_vs->frameDecodeLastPts();
+    pts_delay = videoPicture.pts - frameDecodeLastPts;
+
+    // if the obtained delay is incorrect, key frame only decoding legitimately leaves larger gaps
+    auto speed = m_vs->playbackSpeed();
+    double maxFrameDelay = (speed > PLAYBACK_SPEED_KEYFRAME_ONLY) ? MAX_KEYFRAME_INTERVAL : 1.0;
+    if (pts_delay <= 0 || pts_delay >= maxFrameDelay)
+    {
+      // use the previously calculated delay
+      pts_delay = m_vs->frameDecodeLastDelay();
+    }
+
+    // save delay information for the next time
+    m_vs->setFrameDecodeLastDelay(pts_delay);
+    m_vs->setFrameDecodeLastPts(videoPicture.pts);
+
+    // stream time to wall time
+    pts_delay /= speed;
+
+    // update delay to stay in sync with the master clock, unless video is the master
+    if (m_vs->syncType() != SYNC_TYPE::AV_SYNC_VIDEO_MASTER)
+    {
+      audio_ref_clock = m_vs->masterClock();
+      audio_video_delay = videoPicture.pts - audio_ref_clock;
+    }
+    else
+    {
+      audio_video_delay = 0;
+    }
+
+    // skip or repeat the frame taking into account the delay
+    sync_threshold = (pts_delay > AV_SYNC_THRESHOLD) ? pts_delay : AV_SYNC_THRESHOLD;
 
-      // update read index for the next frame
-      auto& pictureQueueRIndex = m_vs->videoPictureQueueRIndex();
-      if (++pictureQueueRIndex == VIDEO_PICTURE_QUEUE_SIZE)
+    // check audio video delay absolute value is below sync threshold
+    if (fabs(audio_video_delay) < AV_NOSYNC_THRESHOLD)
+    {
+      if (audio_video_delay <= -sync_threshold)
       {
-        pictureQueueRIndex = 0;
+        pts_delay = 0;
       }
+      else if (audio_video_delay >= sync_threshold)
+      {
+        pts_delay = 2 * pts_delay;
+      }
+    }
 
-      // lock videopicture queue mutex
-      auto& pictureQueueMutex = m_vs->pictureQueueMutex();
-      SDL_LockMutex(pictureQueueMutex);
+    auto frameDecodeTimer = m_vs->frameDecodeTimer() + pts_delay;
+    m_vs->setFrameDecodeTimer(frameDecodeTimer);
+    auto now = av_gettime() / 1000000.0;
 
-      // decrease videopicture queue size
-      auto& pictureQueueSize = m_vs->videoPictureQueueSize();
-      pictureQueueSize--;
+    // drop the picture when its display window is already over and a newer one is waiting
+    if (m_vs->isFrameDropEnabled() && pictureQueueSize > 1)
+    {
+      auto& nextPicture = m_vs->nextVideoPicture();
+      double duration = nextPicture.pts - videoPicture.pts;
+      if (nextPicture.serial != videoPicture.serial || duration <= 0 || duration >= maxFrameDelay)
+      {
+        duration = pts_delay;
+      }
+      else
+      {
+        duration /= speed;
+      }
 
-      // notify other threads waiting for the videoPicture queue
-      auto& pictureQueueCond = m_vs->pictureQueueCond();
-      SDL_CondSignal(pictureQueueCond);
+      if (now > frameDecodeTimer + duration)
+      {
+        m_vs->addFrameDroppedLate();
+        m_vs->popVideoPicture();
+        continue;
+      }
+    }
 
-      // unlock videoPicture queue mutex
-      SDL_UnlockMutex(pictureQueueMutex);
+    // compute the real delay
+    real_delay = frameDecodeTimer - now;
+    if (real_delay < 0.010)
+    {
+      real_delay = 0.010;
     }
-  }
-  else
-  {
-    this->scheduleRefresh(100);
+
+    this->scheduleRefresh((int)(real_delay * 1000 + 0.5));
+
+    // the video clock follows the picture on screen
+    m_vs->setVideoDisplayClock(videoPicture.pts, videoPicture.serial);
+
+    // show the frame on the sdl_surface
+    this->videoDisplay();
+
+    // release the picture for the decoder
+    m_vs->popVideoPicture();
+    return;
   }
 }
 
@@ -414,23 +585,51 @@ void VideoRenderer::videoDisplay()
   }
 }
 
-double VideoRenderer::getAudioClock()
+void VideoRenderer::stepPlaybackSpeed(const int& direction)
+{
+  if (!m_vs)
+  {
+    return;
+  }
+
+  // move to the next step above or below the current rate
+  auto speed = m_vs->playbackSpeed();
+  auto nextSpeed = speed;
+  for (auto step : PLAYBACK_SPEED_STEPS)
+  {
+    if (direction > 0 && step > speed)
+    {
+      nextSpeed = step;
+      break;
+    }
+    if (direction < 0 && step < speed)
+    {
+      nextSpeed = step;
+    }
+  }
+
+  m_vs->setPlaybackSpeed(nextSpeed);
+  std::cout << "playback speed : " << m_vs->playbackSpeed() << "x" << std::endl;
+}
+
+void VideoRenderer::stepTrickPlay(const int& direction)
 {
-  auto& audioCodecCtx = m_vs->audioCodecCtx();
-  auto& audioStream = m_vs->audioStream();
-  double pts = m_vs->audioClock();
-  int hw_buf_size = m_vs->audioBufSize() - m_vs->audioBufIndex();
-  int bytes_per_sec = 0;
-  int n = 2 * audioCodecCtx->ch_layout.nb_channels;
-  if (audioStream)
+  if (!m_vs)
   {
-    bytes_per_sec = audioCodecCtx->sample_rate * n;
+    return;
   }
 
-  if (bytes_per_sec)
+  // pressing the same direction again doubles the rate, the other one starts over at 2x
+  auto rate = m_vs->trickPlay();
+  auto nextRate = 0;
+  if (direction > 0)
+  {
+    nextRate = (rate > 0) ? std::min(rate * 2, TRICK_PLAY_RATE_MAX) : 2;
+  }
+  else if (direction < 0)
   {
-    pts -= (double)hw_buf_size / bytes_per_sec;
+    nextRate = (rate < 0) ? std::max(rate * 2, -TRICK_PLAY_RATE_MAX) : -2;
   }
 
-  return pts;
+  m_vs->setTrickPlay(nextRate);
 }
@@ -21,13 +21,18 @@ private:
   SDL_Window* m_screen = nullptr;
   SDL_Texture* m_texture = nullptr;
   SDL_Renderer* m_renderer = nullptr;
+  // serial of the last picture shown
+  int m_lastSerial = -1;
   
   int displayThread();
   void scheduleRefresh(int delay);
   void videoRefreshTimer();
   static Uint32 sdlRefreshTimerCb(Uint32 interval, void* param);
   void videoDisplay();
-  double getAudioClock();
+  // direction > 0 for the next faster rate, < 0 for the next slower one
+  void stepPlaybackSpeed(const int& direction);
+  // direction > 0 for faster fast forward, < 0 for faster rewind, 0 to stop
+  void stepTrickPlay(const int& direction);
 };
 
 } // player
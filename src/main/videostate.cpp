@@ -1,5 +1,8 @@
 
 #include <iostream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
 #include "videostate.h"
 #include "audiodecoder.h"
 
@@ -11,18 +14,12 @@ VideoState::VideoState()
   m_screenMutex = SDL_CreateMutex();
   m_pictqMutex = SDL_CreateMutex();
   m_pictqCond = SDL_CreateCond();
+
+  this->setVideoPictureQueueCapacity(VIDEO_PICTURE_QUEUE_SIZE);
 }
 
 VideoState::~VideoState()
 {
-  if (m_flushPkt)
-  {
-    // wipe the packet
-    av_packet_unref(m_flushPkt);
-    av_packet_free(&m_flushPkt);
-    m_flushPkt = nullptr;
-  }
-
   if (m_formatCtx)
   {
     // close the opened input avformatcontext
@@ -52,6 +49,14 @@ VideoState::~VideoState()
     m_videoCtx = nullptr;
   }
 
+  this->releasePictures();
+
+  if (m_decodeVideoSwsCtx)
+  {
+    sws_freeContext(m_decodeVideoSwsCtx);
+    m_decodeVideoSwsCtx = nullptr;
+  }
+
   if (m_screenMutex)
   {
     SDL_DestroyMutex(m_screenMutex);
@@ -84,105 +89,192 @@ VideoState::~VideoState()
   SDL_Quit();
 }
 
-void VideoState::allocPicture()
+void VideoState::setVideoPictureQueueCapacity(const int& capacity)
 {
-  m_flushPkt = av_packet_alloc();
-  m_flushPkt->data = (uint8_t*)"FLUSH";
+  this->releasePictures();
 
-  auto videoPicture = &m_pictureQueue[m_pictqWindex];
+  // preallocate the frame shells, the conversion buffers follow the first frame of each size
+  m_pictureQueue.resize(capacity > 0 ? capacity : 1);
+  for (auto& videoPicture : m_pictureQueue)
+  {
+    videoPicture.frame = av_frame_alloc();
+  }
+
+  m_pictqSize = 0;
+  m_pictqRindex = 0;
+  m_pictqWindex = 0;
+}
 
-  // check if the sdl_overlay is allocated
-  if (videoPicture->frame)
+void VideoState::releasePictures()
+{
+  for (auto& videoPicture : m_pictureQueue)
   {
-    // we already have an avframe allocated, free memory
-    av_frame_free(&videoPicture->frame);
-    av_free(videoPicture->frame);
+    // release the decoder buffers still referenced and the conversion buffers
+    if (videoPicture.frame)
+    {
+      av_frame_free(&videoPicture.frame);
+    }
+
+    if (videoPicture.scaledFrame)
+    {
+      av_frame_free(&videoPicture.scaledFrame);
+    }
   }
+  m_pictureQueue.clear();
+}
+
+int VideoState::videoPictureQueueSize()
+{
+  SDL_LockMutex(m_pictqMutex);
+  int size = m_pictqSize;
+  SDL_UnlockMutex(m_pictqMutex);
+  return size;
+}
+
+void VideoState::popVideoPicture()
+{
+  // update read index for the next frame
+  if (++m_pictqRindex == (int)m_pictureQueue.size())
+  {
+    m_pictqRindex = 0;
+  }
+
+  // lock videopicture queue mutex
+  SDL_LockMutex(m_pictqMutex);
+
+  // decrease videopicture queue size
+  m_pictqSize--;
+
+  // notify other threads waiting for the videoPicture queue
+  SDL_CondSignal(m_pictqCond);
+
+  // unlock videoPicture queue mutex
+  SDL_UnlockMutex(m_pictqMutex);
+}
+
+void VideoState::allocPicture(const int& width, const int& height)
+{
+  auto videoPicture = &m_pictureQueue[m_pictqWindex];
 
   // lock global screen mutex
   SDL_LockMutex(m_screenMutex);
 
-  // get the size in bytes required to store an image with the given parameters
-  int numBytes = 0;
-  numBytes = av_image_get_buffer_size(
-    AV_PIX_FMT_YUV420P
-    , m_videoCtx->width
-    , m_videoCtx->height
-    , 32
-    );
-
-  // allocate image data buffer
-  auto buffer = (uint8_t*)av_malloc(numBytes * sizeof(uint8_t));
+  // check if the conversion buffer is allocated
+  if (videoPicture->scaledFrame)
+  {
+    // we already have an avframe allocated, free memory
+    av_frame_free(&videoPicture->scaledFrame);
+  }
+  videoPicture->allocated = 0;
 
   // alloc the avframe later used to contain the scaled frame
-  videoPicture->frame = av_frame_alloc();
-  if (videoPicture->frame == nullptr)
+  videoPicture->scaledFrame = av_frame_alloc();
+  if (videoPicture->scaledFrame == nullptr)
   {
+    SDL_UnlockMutex(m_screenMutex);
     return;
   }
 
-  // the fields of the given image are filled in by using the buffer which points to the image data buffer
-  av_image_fill_arrays(
-    videoPicture->frame->data
-    , videoPicture->frame->linesize
-    , buffer
-    , AV_PIX_FMT_YUV420P
-    , m_videoCtx->width
-    , m_videoCtx->height
-    , 32
-    );
+  // allocate a ref-counted image buffer, so the displayed frame can reference it
+  videoPicture->scaledFrame->format = AV_PIX_FMT_YUV420P;
+  videoPicture->scaledFrame->width = width;
+  videoPicture->scaledFrame->height = height;
+  if (av_frame_get_buffer(videoPicture->scaledFrame, 32) < 0)
+  {
+    av_frame_free(&videoPicture->scaledFrame);
+    SDL_UnlockMutex(m_screenMutex);
+    return;
+  }
 
   // unlock mutex
   SDL_UnlockMutex(m_screenMutex);
 
   // update videoPicture struct fields
-  videoPicture->width = m_videoCtx->width;
-  videoPicture->height = m_videoCtx->height;
+  videoPicture->width = width;
+  videoPicture->height = height;
   videoPicture->allocated = 1;
 }
 
-int VideoState::queuePicture(AVFrame* pFrame, const double& pts)
+int VideoState::queuePicture(AVFrame* pFrame, const double& pts, const int& serial)
 {
+  // read time of the packet, carried through the decoder in the opaque field
+  auto receivedTime = (int64_t)(intptr_t)pFrame->opaque;
+
   // lock videostate pictq mutex
   SDL_LockMutex(m_pictqMutex);
 
   // wait until we have space for a new picture in pictq
-  while (m_pictqSize >= VIDEO_PICTURE_QUEUE_SIZE)
+  while (m_pictqSize >= (int)m_pictureQueue.size())
   {
-    SDL_CondWait(m_pictqCond, m_pictqMutex);
+    // a seek happened while we were waiting, or we are shutting down
+    if (serial != this->videoPacketSerial() || m_isPlayerFinished)
+    {
+      SDL_UnlockMutex(m_pictqMutex);
+      return 0;
+    }
+    SDL_CondWaitTimeout(m_pictqCond, m_pictqMutex, 10);
   }
 
   // unlock pictq mutex
   SDL_UnlockMutex(m_pictqMutex);
 
-  auto videoPicture = &m_pictureQueue[m_pictqWindex];
-
-  // if the videopicture sdl_overlay is not allocated or has a different width, height
-  if (!videoPicture->frame ||
-      videoPicture->width != m_videoCtx->width ||
-      videoPicture->height != m_videoCtx->height)
+  // never convert a picture that belongs to an earlier seek
+  if (serial != this->videoPacketSerial())
   {
-    // set sdl_overlay not allocated
-    videoPicture->allocated = 0;
+    return 0;
+  }
 
-    // allocate a new sdl_overlay for the videoPicture struct
-    this->allocPicture();
+  auto videoPicture = &m_pictureQueue[m_pictqWindex];
+  if (!videoPicture->frame)
+  {
+    return -1;
   }
 
-  // check the new sdl_overlay was correctly allocated
-  if (videoPicture->frame)
+  // drop the reference kept from the last time this slot was displayed
+  av_frame_unref(videoPicture->frame);
+
+  auto pixFmt = (AVPixelFormat)pFrame->format;
+  if (pixFmt == AV_PIX_FMT_YUV420P)
   {
-    // so now we've got pictures lining up onto our picture queue with proper PTS values
-    videoPicture->pts = pts;
+    // the decoder already outputs the planes the texture wants, take its buffers as they are.
+    // yuvj420p has the same layout but full range, it goes through sws to be
+    // brought to the limited range the yv12 texture expects
+    av_frame_move_ref(videoPicture->frame, pFrame);
+  }
+  else
+  {
+    // if the conversion buffer is not allocated or has a different width, height
+    if (!videoPicture->scaledFrame ||
+        videoPicture->width != pFrame->width ||
+        videoPicture->height != pFrame->height)
+    {
+      this->allocPicture(pFrame->width, pFrame->height);
+    }
 
-    // set videopicture avframe info using the last decoded frame
-    videoPicture->frame->pict_type = pFrame->pict_type;
-    videoPicture->frame->pts = pFrame->pts;
-    videoPicture->frame->pkt_dts = pFrame->pkt_dts;
-    videoPicture->frame->key_frame = pFrame->key_frame;
-    videoPicture->frame->best_effort_timestamp = pFrame->best_effort_timestamp;
-    videoPicture->frame->width = pFrame->width;
-    videoPicture->frame->height = pFrame->height;
+    // check the conversion buffer was correctly allocated
+    if (!videoPicture->scaledFrame)
+    {
+      return -1;
+    }
+
+    // the context is only rebuilt when the source format or size changes
+    m_decodeVideoSwsCtx = sws_getCachedContext(
+      m_decodeVideoSwsCtx
+      , pFrame->width
+      , pFrame->height
+      , pixFmt
+      , pFrame->width
+      , pFrame->height
+      , AV_PIX_FMT_YUV420P
+      , SWS_BILINEAR
+      , nullptr
+      , nullptr
+      , nullptr);
+    if (!m_decodeVideoSwsCtx)
+    {
+      std::cerr << "Could not create the conversion context" << std::endl;
+      return -1;
+    }
 
     // scale the image in pFrame->data and put the resulting scaled image in pict->data
     sws_scale(
@@ -190,30 +282,44 @@ int VideoState::queuePicture(AVFrame* pFrame, const double& pts)
       , (uint8_t const* const*)pFrame->data
       , pFrame->linesize
       , 0
-      , m_videoCtx->height
-      , videoPicture->frame->data
-      , videoPicture->frame->linesize
+      , pFrame->height
+      , videoPicture->scaledFrame->data
+      , videoPicture->scaledFrame->linesize
       );
 
-    // update videopicture queue write index
-    m_pictqWindex++;
+    av_frame_ref(videoPicture->frame, videoPicture->scaledFrame);
 
-    // if the write index has reached the videopicture queue size
-    if (m_pictqWindex == VIDEO_PICTURE_QUEUE_SIZE)
-    {
-      m_pictqWindex = 0;
-    }
+    // set videopicture avframe info using the last decoded frame
+    videoPicture->frame->pict_type = pFrame->pict_type;
+    videoPicture->frame->pts = pFrame->pts;
+    videoPicture->frame->pkt_dts = pFrame->pkt_dts;
+    videoPicture->frame->key_frame = pFrame->key_frame;
+    videoPicture->frame->best_effort_timestamp = pFrame->best_effort_timestamp;
+  }
 
-    // lock videopicture queue
-    SDL_LockMutex(m_pictqMutex);
+  // so now we've got pictures lining up onto our picture queue with proper PTS values
+  videoPicture->pts = pts;
+  videoPicture->serial = serial;
+  videoPicture->receivedTime = receivedTime;
 
-    // increase videopictq queue size
-    m_pictqSize++;
+  // update videopicture queue write index
+  m_pictqWindex++;
 
-    // unlock videopicture queue
-    SDL_UnlockMutex(m_pictqMutex);
+  // if the write index has reached the videopicture queue size
+  if (m_pictqWindex == (int)m_pictureQueue.size())
+  {
+    m_pictqWindex = 0;
   }
 
+  // lock videopicture queue
+  SDL_LockMutex(m_pictqMutex);
+
+  // increase videopictq queue size
+  m_pictqSize++;
+
+  // unlock videopicture queue
+  SDL_UnlockMutex(m_pictqMutex);
+
   return 0;
 }
 
@@ -227,18 +333,101 @@ int VideoState::pushVideoPacketRead(AVPacket* packet)
   return m_videoPacketQueue.push(packet);
 }
 
-int VideoState::popAudioPacketRead(AVPacket* packet)
+int VideoState::popAudioPacketRead(AVPacket* packet, const int& timeoutMs, int* serial)
 {
-  int ret = m_audioPacketQueue.pop(packet);
+  int ret = m_audioPacketQueue.pop(packet, timeoutMs, serial);
+  if (ret >= 0)
+  {
+    this->notifyPacketReadSpace();
+  }
   return (packet == nullptr) ? -1 : ret;
 }
 
-int VideoState::popVideoPacketRead(AVPacket* packet)
+int VideoState::popVideoPacketRead(AVPacket* packet, const int& timeoutMs, int* serial)
 {
-  int ret = m_videoPacketQueue.pop(packet);
+  int ret = m_videoPacketQueue.pop(packet, timeoutMs, serial);
+  if (ret >= 0)
+  {
+    this->notifyPacketReadSpace();
+  }
   return (packet == nullptr) ? -1 : ret;
 }
 
+void VideoState::setPacketReadLimits(const double& maxSeconds, const int64_t& maxBytes)
+{
+  // written so that nan gets the minimum too
+  m_maxStreamPacketReadSeconds = (maxSeconds >= MIN_STREAM_PACKET_READ_DURATION) ? maxSeconds : MIN_STREAM_PACKET_READ_DURATION;
+  m_maxStreamPacketReadSize = std::max<int64_t>(maxBytes, MIN_STREAM_PACKET_READ_SIZE);
+}
+
+bool VideoState::streamHasEnoughPackets(const PacketQueue& queue, const AVStream* stream) const
+{
+  // a stream we do not play never holds the reader back
+  if (stream == nullptr || queue.isAborted())
+  {
+    return true;
+  }
+
+  if (queue.isFull() || queue.size() >= m_maxStreamPacketReadSize)
+  {
+    return true;
+  }
+
+  // packets without a duration leave the decision to the byte limit
+  return queue.durationSeconds() >= m_maxStreamPacketReadSeconds;
+}
+
+bool VideoState::hasEnoughPackets() const
+{
+  // trick play only needs the next key frames, reading further delays the
+  // reaction to the next rate change or seek
+  if (m_trickPlay != 0)
+  {
+    return m_videoPacketQueue.nbPackets() >= TRICK_PLAY_QUEUED_PACKETS;
+  }
+
+  if (m_audioPacketQueue.size() + m_videoPacketQueue.size() > MAX_PACKET_READ_SIZE)
+  {
+    return true;
+  }
+
+  // a ring that is about to overflow must stop the reader whatever the other stream holds
+  if (m_audioPacketQueue.isFull() || m_videoPacketQueue.isFull())
+  {
+    return true;
+  }
+
+  // keep reading while any stream is still below its limits, so an interleaving
+  // gap in the file cannot starve the other decoder
+  return this->streamHasEnoughPackets(m_audioPacketQueue, m_audioStream)
+    && this->streamHasEnoughPackets(m_videoPacketQueue, m_videoStream);
+}
+
+void VideoState::waitForPacketReadSpace(const int& timeoutMs)
+{
+  std::unique_lock<std::mutex> lock(m_readMutex);
+  m_readWaiting = true;
+  int trickPlay = m_trickPlay;
+  m_readCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, trickPlay]
+  {
+    return !this->hasEnoughPackets() || m_seekReq || m_isPlayerFinished || m_trickPlay != trickPlay;
+  });
+  m_readWaiting = false;
+}
+
+void VideoState::notifyPacketReadSpace()
+{
+  // consumers are decode threads, the audio callback only reads the pcm ring.
+  // the waiter registers under the lock before checking its predicate, so taking
+  // the lock to notify means it either sees the change or gets the wakeup
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_readWaiting)
+  {
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    m_readCond.notify_one();
+  }
+}
+
 double VideoState::masterClock()
 {
   switch (m_avSyncType)
@@ -268,45 +457,184 @@ double VideoState::masterClock()
 
 double VideoState::calcVideoClock()
 {
-  double delta = (av_gettime() - m_videoDecodeCurrentPtsTime) / 1000000.0;
-  return m_videoDecodeCurrentPts + delta;
+  return m_videoClk.get(this->videoPacketSerial());
 }
 
 double VideoState::calcAudioClock()
 {
-  double pts = m_audioClock;
-  int hw_buf_size = m_audioBufSize - m_audioBufIndex;
-  int bytes_per_sec = 0;
-  int n = 2 * m_audioCtx->ch_layout.nb_channels;
+  // NAN while the clock still describes data from before the last seek
+  return m_audioClk.get(this->audioPacketSerial());
+}
+
+double VideoState::calcExternalClock()
+{
+  return m_externalClk.get();
+}
 
-  if (m_audioStream)
+void VideoState::setPlaybackSpeed(const double& speed)
+{
+  auto playbackSpeed = std::clamp(speed, PLAYBACK_SPEED_MIN, PLAYBACK_SPEED_MAX);
+  if (playbackSpeed == m_playbackSpeed)
   {
-    bytes_per_sec = m_audioCtx->sample_rate * n;
+    return;
   }
 
-  if (bytes_per_sec)
+  // every clock keeps its position and continues at the new rate
+  m_audioClk.setSpeed(playbackSpeed);
+  m_videoClk.setSpeed(playbackSpeed);
+  m_externalClk.setSpeed(playbackSpeed * m_externalClockSpeed);
+  m_playbackSpeed = playbackSpeed;
+}
+
+void VideoState::setLive(const bool& live, const double& targetLatency)
+{
+  m_live = live;
+  m_liveTargetLatency = targetLatency;
+  m_externalClockSpeed = 1.0;
+  m_externalClk.setSpeed(m_playbackSpeed);
+}
+
+double VideoState::bufferedSeconds(const PacketQueue& queue, const AVStream* stream) const
+{
+  auto duration = queue.durationSeconds();
+  if (duration <= 0 && stream && stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0)
   {
-    pts -= (double) hw_buf_size / bytes_per_sec;
+    // live sources often leave the packet duration unset, count frames instead
+    duration = queue.nbPackets() / av_q2d(stream->avg_frame_rate);
   }
 
-  return pts;
+  return duration;
 }
 
-double VideoState::calcExternalClock()
+void VideoState::updateExternalClockSpeed()
 {
-  m_externalClockTime = av_gettime();
-  m_externalClock = m_externalClockTime / 1000000.0;
+  if (!m_live)
+  {
+    return;
+  }
 
-  return m_externalClock;
+  // judge the level on the video queue, or the audio one for audio only streams
+  auto buffered = m_videoStream
+    ? this->bufferedSeconds(m_videoPacketQueue, m_videoStream)
+    : this->bufferedSeconds(m_audioPacketQueue, m_audioStream);
+
+  double speed = m_externalClockSpeed;
+  if (buffered < m_liveTargetLatency / 2)
+  {
+    // running dry, play slower so the buffer refills
+    speed = std::max(EXTERNAL_CLOCK_SPEED_MIN, speed - EXTERNAL_CLOCK_SPEED_STEP);
+  }
+  else if (buffered > m_liveTargetLatency * 3 / 2)
+  {
+    // falling behind the source, play faster to shed latency
+    speed = std::min(EXTERNAL_CLOCK_SPEED_MAX, speed + EXTERNAL_CLOCK_SPEED_STEP);
+  }
+  else if (speed != 1.0)
+  {
+    // around the target, ease back to real time
+    speed += EXTERNAL_CLOCK_SPEED_STEP * (1.0 - speed) / fabs(1.0 - speed);
+    if (fabs(speed - 1.0) < EXTERNAL_CLOCK_SPEED_STEP)
+    {
+      speed = 1.0;
+    }
+  }
+
+  if (speed != m_externalClockSpeed)
+  {
+    m_externalClockSpeed = speed;
+    m_externalClk.setSpeed(m_playbackSpeed * speed);
+  }
 }
 
+void VideoState::addDisplayLatency(const int64_t& latency)
+{
+  // only the renderer writes, the atomics let stop() read from another thread
+  m_displayLatencyCount++;
+  m_displayLatencyTotal += latency;
+  if (latency > m_displayLatencyMax)
+  {
+    m_displayLatencyMax = latency;
+  }
+}
+
+LatencyStats VideoState::displayLatencyStats() const
+{
+  LatencyStats stats;
+  stats.count = m_displayLatencyCount;
+  stats.total = m_displayLatencyTotal;
+  stats.max = m_displayLatencyMax;
+  return stats;
+}
 
-void VideoState::streamSeek(const int64_t& pos, const int& rel)
+void VideoState::streamSeek(const int64_t& pos, const int64_t& rel)
 {
-  if (!m_seekReq)
   {
+    std::lock_guard<std::mutex> lock(m_seekMutex);
+    if (!m_seekReq)
+    {
+      m_seekOrigin = pos - rel;
+    }
+    // the latest target wins, the reader never seeks to the ones it replaces
     m_seekPos = pos;
-    m_seekFlags = rel < 0 ? AVSEEK_FLAG_BACKWARD : 0;
+    m_seekGeneration++;
     m_seekReq = 1;
   }
+
+  // the read thread may be waiting for queue space
+  this->notifyPacketReadSpace();
+}
+
+SeekTarget VideoState::seekTarget()
+{
+  std::lock_guard<std::mutex> lock(m_seekMutex);
+
+  SeekTarget target;
+  target.pos = m_seekPos;
+  target.generation = m_seekGeneration;
+
+  // land on the key frame before the target, but never behind where a forward
+  // jump started from nor past where a backward one did
+  auto rel = target.pos - m_seekOrigin;
+  if (rel > 0)
+  {
+    target.min = m_seekOrigin + 2;
+  }
+  else if (rel < 0)
+  {
+    target.max = m_seekOrigin - 2;
+  }
+  return target;
+}
+
+void VideoState::finishSeek(const SeekTarget& served)
+{
+  std::lock_guard<std::mutex> lock(m_seekMutex);
+  if (m_seekGeneration == served.generation)
+  {
+    m_seekReq = 0;
+  }
+  else
+  {
+    // a newer request came in meanwhile, it now jumps from where this one went
+    m_seekOrigin = served.pos;
+  }
+}
+
+void VideoState::setExactSeekTarget(const double& pts, const int& videoSerial, const int& audioSerial)
+{
+  // the decoders only look at the target once a packet of the new serials is
+  // queued, which happens after this returns
+  m_exactSeekPts = pts;
+  m_exactSeekVideoSerial = videoSerial;
+  m_exactSeekAudioSerial = audioSerial;
+}
+
+double VideoState::videoSeekTarget(const int& serial) const
+{
+  return (serial >= 0 && serial == m_exactSeekVideoSerial) ? m_exactSeekPts.load() : NAN;
+}
+
+double VideoState::audioSeekTarget(const int& serial) const
+{
+  return (serial >= 0 && serial == m_exactSeekAudioSerial) ? m_exactSeekPts.load() : NAN;
 }
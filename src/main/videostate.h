@@ -5,8 +5,15 @@
 #include <string>
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cmath>
 #include "packetqueue.h"
 #include "videopicture.h"
+#include "pcmringbuffer.h"
+#include "audioparams.h"
+#include "clock.h"
 
 extern "C"
 {
@@ -22,13 +29,62 @@ extern "C"
 }
 
 #define SDL_AUDIO_BUFFER_SIZE 1024
-#define MAX_AUDIO_FRAME_SIZE 192000
+#define PLAYBACK_SPEED_MIN 0.5
+#define PLAYBACK_SPEED_MAX 4.0
+// above this rate the video decoder only decodes key frames
+#define PLAYBACK_SPEED_KEYFRAME_ONLY 2.0
 
-#define VIDEO_PICTURE_QUEUE_SIZE 1
+// default number of decoded pictures buffered between the decoder and the renderer
+#define VIDEO_PICTURE_QUEUE_SIZE 3
+
+// hard cap on the packet bytes buffered by the read thread over all streams
+#define MAX_PACKET_READ_SIZE (15 * 1024 * 1024)
+// default per stream limits, the read thread pauses once every stream reaches one of them
+#define MAX_STREAM_PACKET_READ_SIZE (8 * 1024 * 1024)
+#define MAX_STREAM_PACKET_READ_DURATION 5.0
+// lowest limits accepted, at 0 an empty queue would already count as full
+#define MIN_STREAM_PACKET_READ_SIZE 1024
+#define MIN_STREAM_PACKET_READ_DURATION 0.1
+
+// live streams : buffered media the external clock speed steers toward (s)
+#define LIVE_TARGET_LATENCY 0.2
+// bounds and step of the external clock speed correction
+#define EXTERNAL_CLOCK_SPEED_MIN 0.99
+#define EXTERNAL_CLOCK_SPEED_MAX 1.01
+#define EXTERNAL_CLOCK_SPEED_STEP 0.001
+
+// trick play : fastest fast forward / rewind rate, key frame packets the read
+// thread keeps queued, and wall time each shown key frame aims for (s)
+#define TRICK_PLAY_RATE_MAX 16
+#define TRICK_PLAY_QUEUED_PACKETS 2
+#define TRICK_PLAY_FRAME_INTERVAL 0.25
+
+// low latency profile : pictures buffered ahead of display and buffer target (s)
+#define LOW_LATENCY_PICTURE_QUEUE_SIZE 2
+#define LOW_LATENCY_TARGET_LATENCY 0.05
 
 namespace player
 {
 
+struct LatencyStats
+{
+  // pictures measured
+  uint64_t count = 0;
+  // read to display delay, in microseconds
+  int64_t total = 0;
+  int64_t max = 0;
+};
+
+struct SeekTarget
+{
+  // AV_TIME_BASE, min and max bound where the demuxer may land
+  int64_t pos = 0;
+  int64_t min = INT64_MIN;
+  int64_t max = INT64_MAX;
+  // identifies the request, see VideoState::finishSeek
+  uint64_t generation = 0;
+};
+
 enum class SYNC_TYPE
 {
   // sync to audio clock
@@ -49,7 +105,6 @@ public:
   AVFormatContext*& formatCtx() { return m_formatCtx; }
   int& videoStreamIndex() { return m_videoStreamIndex; }
   int& audioStreamIndex() { return m_audioStreamIndex; }
-  AVPacket*& flushPacket() { return m_flushPkt; }
   AVCodecContext*& videoCodecCtx() { return m_videoCtx; }
   AVStream*& videoStream() { return m_videoStream; }
   AVCodecContext*& audioCodecCtx() { return m_audioCtx; }
@@ -59,27 +114,77 @@ public:
   SDL_AudioDeviceID sdlAudioDeviceID() const { return m_sdlAudioDeviceID; }
   void setSdlAudioDeviceID(const SDL_AudioDeviceID& audioDeviceID) { m_sdlAudioDeviceID = audioDeviceID; };
   bool isPlayerFinished() const { return m_isPlayerFinished; }
-  void setPlayerFinished() { m_isPlayerFinished = true; }
-  int& videoPictureQueueSize() { return m_pictqSize; }
-  int& videoPictureQueueRIndex() { return m_pictqRindex; }
-  int& videoPictureQueueWIndex() { return m_pictqWindex; }
+  void setPlayerFinished() { m_isPlayerFinished = true; this->abortPacketRead(); this->notifyPacketReadSpace(); }
+  // must be called before the decoder starts
+  void setVideoPictureQueueCapacity(const int& capacity);
+  int videoPictureQueueCapacity() const { return (int)m_pictureQueue.size(); }
+  int videoPictureQueueSize();
+  // picture at the read index, and the one queued after it
   VideoPicture& videoPicture() { return m_pictureQueue[m_pictqRindex]; }
-  SDL_mutex*& pictureQueueMutex() { return m_pictqMutex; }
-  SDL_cond*& pictureQueueCond() { return m_pictqCond; }
+  VideoPicture& nextVideoPicture() { return m_pictureQueue[(m_pictqRindex + 1) % m_pictureQueue.size()]; }
+  // release the picture at the read index back to the decoder
+  void popVideoPicture();
+  // late frame dropping in the renderer, never done when video is the master clock
+  bool isFrameDropEnabled() const { return m_frameDrop && m_avSyncType != SYNC_TYPE::AV_SYNC_VIDEO_MASTER; }
+  void setFrameDrop(const bool& frameDrop) { m_frameDrop = frameDrop; }
+  void addFrameDroppedLate() { m_framesDroppedLate++; }
+  uint64_t framesDroppedLate() const { return m_framesDroppedLate; }
+  // low latency : pictures replaced by a newer one before being shown. a burst
+  // from the source, not a slow decoder, so the skip level ignores these
+  void addFrameSuperseded() { m_framesSuperseded++; }
+  uint64_t framesSuperseded() const { return m_framesSuperseded; }
+  // low latency : the renderer shows the newest picture as soon as it is decoded
+  bool isLowLatency() const { return m_lowLatency; }
+  void setLowLatency(const bool& lowLatency) { m_lowLatency = lowLatency; }
+  void addDisplayLatency(const int64_t& latency);
+  LatencyStats displayLatencyStats() const;
   SYNC_TYPE syncType() const { return m_avSyncType; }
-  int queuePicture(AVFrame* pFrame, const double& pts);
+  // playback rate, PLAYBACK_SPEED_MIN to PLAYBACK_SPEED_MAX
+  double playbackSpeed() const { return m_playbackSpeed; }
+  void setPlaybackSpeed(const double& speed);
+  // live mode : the external clock runs slightly faster or slower to keep about
+  // targetLatency seconds buffered, instead of letting the buffer grow or run dry
+  bool isLive() const { return m_live; }
+  void setLive(const bool& live, const double& targetLatency);
+  void updateExternalClockSpeed();
+  double externalClockSpeed() const { return m_externalClockSpeed; }
+  // trick play : key frames only, muted, at 2 to TRICK_PLAY_RATE_MAX times,
+  // backward when negative. 0 for normal playback
+  int trickPlay() const { return m_trickPlay; }
+  void setTrickPlay(const int& rate) { m_trickPlay = rate; this->notifyPacketReadSpace(); }
+  void setSyncType(const SYNC_TYPE& syncType) { m_avSyncType = syncType; }
+  int queuePicture(AVFrame* pFrame, const double& pts, const int& serial);
 
   // For Read(Audio/Video)
   int pushAudioPacketRead(AVPacket* packet);
   int pushVideoPacketRead(AVPacket* packet);
-  int popAudioPacketRead(AVPacket* packet);
-  int popVideoPacketRead(AVPacket* packet);
+  int popAudioPacketRead(AVPacket* packet, const int& timeoutMs = 0, int* serial = nullptr);
+  int popVideoPacketRead(AVPacket* packet, const int& timeoutMs = 0, int* serial = nullptr);
   int sizeAudioPacketRead() const { return m_audioPacketQueue.size(); }
   int sizeVideoPacketRead() const { return m_videoPacketQueue.size(); }
   int nbPacketsAudioRead() const { return m_audioPacketQueue.nbPackets(); }
   int nbPacketsVideoRead() const { return m_videoPacketQueue.nbPackets(); }
+  bool isAudioPacketReadFull() const { return m_audioPacketQueue.isFull(); }
+  bool isVideoPacketReadFull() const { return m_videoPacketQueue.isFull(); }
+  PacketQueueStats audioPacketReadStats() const { return m_audioPacketQueue.stats(); }
+  PacketQueueStats videoPacketReadStats() const { return m_videoPacketQueue.stats(); }
   void clearAudioPacketRead() { m_audioPacketQueue.clear(); }
   void clearVideoPacketRead() { m_videoPacketQueue.clear(); }
+  int flushAudioPacketRead() { return m_audioPacketQueue.flush(); }
+  int flushVideoPacketRead() { return m_videoPacketQueue.flush(); }
+  int audioPacketSerial() const { return m_audioPacketQueue.serial(); }
+  int videoPacketSerial() const { return m_videoPacketQueue.serial(); }
+  void abortPacketRead() { m_audioPacketQueue.abort(); m_videoPacketQueue.abort(); }
+  double durationAudioPacketRead() const { return m_audioPacketQueue.durationSeconds(); }
+  double durationVideoPacketRead() const { return m_videoPacketQueue.durationSeconds(); }
+  void setAudioPacketReadTimeBase(const AVRational& timeBase) { m_audioPacketQueue.setTimeBase(timeBase); }
+  void setVideoPacketReadTimeBase(const AVRational& timeBase) { m_videoPacketQueue.setTimeBase(timeBase); }
+  // per stream limits of the read thread : buffered seconds and bytes, raised to
+  // MIN_STREAM_PACKET_READ_DURATION and MIN_STREAM_PACKET_READ_SIZE
+  void setPacketReadLimits(const double& maxSeconds, const int64_t& maxBytes);
+  bool hasEnoughPackets() const;
+  void waitForPacketReadSpace(const int& timeoutMs);
+  void notifyPacketReadSpace();
 
 
   // For Video Decode
@@ -93,18 +198,25 @@ public:
   void setFrameDecodeLastDelay(const double& frameLastDelay) { m_frameDecodeLastDelay = frameLastDelay; }
   double videoClock() const { return m_videoClock; }
   void setVideoClock(const double& videoClock) { m_videoClock = videoClock; }
-  double videoDecodeCurrentPts() const { return m_videoDecodeCurrentPts; }
-  void setVideoDecodeCurrentPts(const double& videoCurrentPts) { m_videoDecodeCurrentPts = videoCurrentPts; }
-  int64_t videoDecodeCurrentPtsTime() const { return m_videoDecodeCurrentPtsTime; }
-  void setVideoDecodeCurrentPtsTime(const int64_t& videoCurrentPtsTime) { m_videoDecodeCurrentPtsTime = videoCurrentPtsTime; }
+  // set by the renderer with the picture put on screen
+  void setVideoDisplayClock(const double& pts, const int& serial) { m_videoClk.set(pts, serial); m_displayedPts = pts; }
+  // pts of the last picture put on screen, whatever clock is the master
+  double displayedPts() const { return m_displayedPts; }
 
   // For Audio Decode  
   double audioClock() const { return m_audioClock; }
   void setAudioClock(const double& audioClock) { m_audioClock = audioClock; }
-  unsigned int audioBufSize() const { return m_audioBufSize; }
-  void setAudioBufSize(const unsigned int& audioBufSize) { m_audioBufSize = audioBufSize; }
-  unsigned int audioBufIndex() const { return m_audioBufIndex; }
-  void setAudioBufIndex(const unsigned int& audioBufIndex) { m_audioBufIndex = audioBufIndex; }
+  int audioBufSerial() const { return m_audioBufSerial; }
+  void setAudioBufSerial(const int& serial) { m_audioBufSerial = serial; }
+  // set by the audio callback : pts of the sample leaving the speaker at time (av_gettime_relative)
+  void setAudioPlayClock(const double& pts, const int& serial, const int64_t& time) { m_audioClk.set(pts, serial, time); }
+  int audioBytesPerSec() const { return m_audioTgt.bytesPerSec; }
+  const AudioParams& audioTgt() const { return m_audioTgt; }
+  // bytes of one sdl device buffer, still queued when the callback returns
+  int audioHwBufSize() const { return m_audioHwBufSize; }
+  void setAudioHwBufSize(const int& hwBufSize) { m_audioHwBufSize = hwBufSize; }
+  void setAudioTgt(const AudioParams& audioTgt) { m_audioTgt = audioTgt; }
+  PcmRingBuffer& audioRingBuffer() { return m_audioRingBuffer; }
   double audioDiffCum() const { return m_audioDiffCum; }
   void setAudioDiffCum(const double& diffCum) { m_audioDiffCum = diffCum; }
   double audioDiffAvgCoef() const { return m_audioDiffAvgCoef; }
@@ -113,24 +225,40 @@ public:
   void setAudioDiffThreshold(const double& diffThreshold) { m_audioDiffThreshold = diffThreshold; }
   double audioDiffAvgCount() const { return m_audioDiffAvgCount; }
   void setAudioDiffAvgCount(const double& diffAvgCount) { m_audioDiffAvgCount = diffAvgCount; }
-  uint8_t* audioArrayBuf() { return m_audioBuf; }
-  int audioArrayBufSize() const { return (MAX_AUDIO_FRAME_SIZE * 3) / 2; }
 
   // For calculate clock.
   double masterClock();
   double calcAudioClock(); // For AudioDecoder
+  double calcExternalClock();
+  // restart the external clock from pts, it then runs with the wall clock
+  void setExternalClock(const double& pts, const int& serial) { m_externalClk.set(pts, serial); }
 
   // For Seek
   int seekRequest() const { return m_seekReq; }
-  void setSeekRequest(const int& req) { m_seekReq = req; }
+  // latest requested target, AV_TIME_BASE
   int64_t seekPos() const { return m_seekPos; }
-  int seekFlags() const { return m_seekFlags; }
-  void streamSeek(const int64_t& pos, const int& rel);
+  // seek to pos, rel being the jump from the current position (AV_TIME_BASE).
+  // requests arriving before the reader got to the previous one replace it
+  void streamSeek(const int64_t& pos, const int64_t& rel);
+  // the request to serve, with the bounds avformat_seek_file may land in
+  SeekTarget seekTarget();
+  // clear the request unless a newer one came in while served was being done
+  void finishSeek(const SeekTarget& served);
+  // exact seeking : the decoders drop what comes before the requested position
+  bool isExactSeek() const { return m_exactSeek; }
+  void setExactSeek(const bool& exactSeek) { m_exactSeek = exactSeek; }
+  // position (s) the packets of the given serials have to start from
+  void setExactSeekTarget(const double& pts, const int& videoSerial, const int& audioSerial);
+  // NAN when serial is not the one of an exact seek
+  double videoSeekTarget(const int& serial) const;
+  double audioSeekTarget(const int& serial) const;
 
 private:
-  void allocPicture();
+  bool streamHasEnoughPackets(const PacketQueue& queue, const AVStream* stream) const;
+  double bufferedSeconds(const PacketQueue& queue, const AVStream* stream) const;
+  void allocPicture(const int& width, const int& height);
+  void releasePictures();
   double calcVideoClock();
-  double calcExternalClock();
 
   AVFormatContext* m_formatCtx = nullptr;
 
@@ -139,11 +267,16 @@ private:
   AVStream* m_audioStream = nullptr;
   AVCodecContext* m_audioCtx = nullptr;
   PacketQueue m_audioPacketQueue;
-  uint8_t m_audioBuf[(MAX_AUDIO_FRAME_SIZE * 3) /2];
-  unsigned int m_audioBufSize = 0;
-  unsigned int m_audioBufIndex = 0;
-  int m_audioPktSize = 0;
+  // what the opened device plays, the resampler converts straight to it
+  AudioParams m_audioTgt;
+  std::atomic_int m_audioBufSerial = -1;
+  // pts right after the last decoded samples
   double m_audioClock = 0.0;
+  // decoded samples waiting for the audio callback
+  PcmRingBuffer m_audioRingBuffer;
+  // position of the sample leaving the speaker
+  Clock m_audioClk;
+  int m_audioHwBufSize = 0;
   double m_audioDiffCum = 0.0;
   double m_audioDiffAvgCoef = 0.0;
   double m_audioDiffThreshold = 0.0;
@@ -155,41 +288,64 @@ private:
   AVCodecContext* m_videoCtx = nullptr;
   PacketQueue m_videoPacketQueue;
   struct SwsContext* m_decodeVideoSwsCtx = nullptr;
-  double m_frameDecodeTimer = 0.0;
+  std::atomic<double> m_frameDecodeTimer = 0.0;
   double m_frameDecodeLastPts = 0.0;
   double m_frameDecodeLastDelay = 0.0;
   double m_videoClock = 0.0;
-  double m_videoDecodeCurrentPts = 0.0;
-  int64_t m_videoDecodeCurrentPtsTime = 0;
+  // position of the picture on screen
+  Clock m_videoClk;
+  std::atomic<double> m_displayedPts = 0.0;
   // SDL_surface mutex
   SDL_mutex* m_screenMutex = nullptr;
 
   // av sync
   SYNC_TYPE m_avSyncType = SYNC_TYPE::AV_SYNC_AUDIO_MASTER;
-  double m_externalClock = 0.0;
-  int64_t m_externalClockTime = 0;
+  std::atomic<double> m_playbackSpeed = 1.0;
+  Clock m_externalClk;
+  std::atomic_bool m_live = false;
+  double m_liveTargetLatency = LIVE_TARGET_LATENCY;
+  std::atomic<double> m_externalClockSpeed = 1.0;
+  std::atomic_int m_trickPlay = 0;
+
+  // read thread backpressure
+  double m_maxStreamPacketReadSeconds = MAX_STREAM_PACKET_READ_DURATION;
+  int64_t m_maxStreamPacketReadSize = MAX_STREAM_PACKET_READ_SIZE;
+  std::mutex m_readMutex;
+  std::condition_variable m_readCond;
+  std::atomic_bool m_readWaiting = false;
 
   // seeking
-  int m_seekReq = 0;
-  int m_seekFlags = 0;
-  int64_t m_seekPos = 0;
+  std::mutex m_seekMutex;
+  std::atomic_int m_seekReq = 0;
+  std::atomic<int64_t> m_seekPos = 0;
+  // position the pending requests started from, their jumps add up from it
+  int64_t m_seekOrigin = 0;
+  uint64_t m_seekGeneration = 0;
+  std::atomic_bool m_exactSeek = false;
+  std::atomic<double> m_exactSeekPts = NAN;
+  std::atomic_int m_exactSeekVideoSerial = -1;
+  std::atomic_int m_exactSeekAudioSerial = -1;
 
   // video picture queue
-  VideoPicture m_pictureQueue[VIDEO_PICTURE_QUEUE_SIZE];
+  std::vector<VideoPicture> m_pictureQueue;
   int m_pictqSize = 0;
   int m_pictqRindex = 0;
   int m_pictqWindex = 0;
   SDL_mutex* m_pictqMutex = nullptr;
   SDL_cond* m_pictqCond = nullptr;
+  bool m_frameDrop = true;
+  std::atomic<uint64_t> m_framesDroppedLate = 0;
+  std::atomic<uint64_t> m_framesSuperseded = 0;
+  std::atomic_bool m_lowLatency = false;
+  std::atomic<uint64_t> m_displayLatencyCount = 0;
+  std::atomic<int64_t> m_displayLatencyTotal = 0;
+  std::atomic<int64_t> m_displayLatencyMax = 0;
 
 
   // output audio device index in windows
   int m_outputAudioDeviceIndex = -1;
   SDL_AudioDeviceID m_sdlAudioDeviceID = 0;
 
-  //
-  AVPacket* m_flushPkt = nullptr;
-
   std::atomic_bool m_isPlayerFinished = false;
 
 };